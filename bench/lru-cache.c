@@ -0,0 +1,352 @@
+#include "lru-cache.h"
+#include "lru-cache-mrc.h"
+#include "perf-counters.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+#include <errno.h>
+
+/*
+ * Measures time and hardware counters per operation for lookup hits, lookup hits observed by a
+ * miss ratio curve estimator, misses with eviction, resizes, flushes and bulk loads (per key). Each
+ * result is printed as one line of key=value pairs, with "-" for unavailable counters, so that the
+ * output of two builds can be compared:
+ *
+ * usage: bench/lru-cache [-n nmemb] [-o ops] > new.txt
+ *        bench/lru-cache -c base.txt new.txt [threshold_percent]
+ */
+
+#define RESIZES 8
+#define FLUSHES 8
+#define MRC_RATE 0.01
+
+static struct lru_cache c;
+static struct perf_counters counters;
+static struct timespec started;
+static double elapsed;
+
+static void *hashmap;
+static void *cache;
+
+static uint64_t mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static uint32_t hash_u64(const void *a)
+{
+    uint64_t h;
+    memcpy(&h, a, sizeof(h));
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(uint64_t));
+}
+
+static void start(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    perf_counters_start(&counters);
+}
+
+static void stop(void)
+{
+    struct timespec ts;
+
+    perf_counters_stop(&counters);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    elapsed += (ts.tv_sec - started.tv_sec) + (ts.tv_nsec - started.tv_nsec) / 1e9;
+}
+
+static void report(const char *op, uint64_t ops)
+{
+    int i;
+
+    printf("op=%s ns=%.3f", op, elapsed * 1e9 / ops);
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (perf_counter_available(&counters, i)) {
+            printf(" %s=%.3f", perf_counter_names[i], (double)counters.value[i] / ops);
+        } else {
+            printf(" %s=-", perf_counter_names[i]);
+        }
+    }
+
+    printf("\n");
+
+    perf_counters_clear(&counters);
+    elapsed = 0.0;
+}
+
+static int resize(uint32_t nmemb)
+{
+    int rv;
+    size_t hashmap_bytes, cache_bytes;
+    void *p;
+
+    rv = lru_cache_set_nmemb(&c, nmemb, &hashmap_bytes, &cache_bytes);
+    if (rv != 0) {
+        return rv;
+    }
+
+    if ((p = realloc(hashmap, hashmap_bytes)) == NULL) {
+        return ENOMEM;
+    }
+
+    hashmap = p;
+
+    if ((p = realloc(cache, cache_bytes)) == NULL) {
+        return ENOMEM;
+    }
+
+    cache = p;
+    return lru_cache_set_memory(&c, hashmap, cache);
+}
+
+static void fill(uint32_t nmemb)
+{
+    bool put;
+    uint32_t i;
+    uint64_t key;
+
+    for (i = 0; i < nmemb; i++) {
+        key = mix(i);
+        lru_cache_get_or_put(&c, &key, &put);
+    }
+}
+
+static int run(uint32_t nmemb, uint64_t ops)
+{
+    int rv;
+    bool put;
+    uint64_t i;
+    struct lru_cache_mrc mrc;
+    uint64_t *keys = malloc(ops * sizeof(*keys));
+    uint64_t *warm = malloc(nmemb * sizeof(*warm));
+
+    if (keys == NULL || warm == NULL) {
+        rv = ENOMEM;
+        goto out;
+    }
+
+    if ((rv = lru_cache_init(&c, sizeof(uint64_t), hash_u64, compare_u64, NULL)) != 0) {
+        goto out;
+    }
+
+    if ((rv = resize(nmemb)) != 0) {
+        goto out;
+    }
+
+    printf("# lru-cache-bench nmemb=%u ops=%llu counters=%d\n",
+        nmemb, (unsigned long long)ops, perf_counters_open(&counters));
+
+    fill(nmemb);
+
+    for (i = 0; i < ops; i++) {
+        keys[i] = mix(mix(i) % nmemb);
+    }
+
+    start();
+    for (i = 0; i < ops; i++) {
+        lru_cache_get_or_put(&c, &keys[i], &put);
+    }
+    stop();
+    report("hit", ops);
+
+    if ((rv = lru_cache_mrc_init(&mrc, MRC_RATE, nmemb)) != 0) {
+        goto out;
+    }
+
+    c.trace = lru_cache_mrc_access;
+    c.trace_arg = &mrc;
+
+    start();
+    for (i = 0; i < ops; i++) {
+        lru_cache_get_or_put(&c, &keys[i], &put);
+    }
+    stop();
+    report("hit_mrc", ops);
+
+    c.trace = NULL;
+    lru_cache_mrc_free(&mrc);
+
+    for (i = 0; i < ops; i++) {
+        keys[i] = mix(nmemb + i);
+    }
+
+    start();
+    for (i = 0; i < ops; i++) {
+        lru_cache_get_or_put(&c, &keys[i], &put);
+    }
+    stop();
+    report("miss_evict", ops);
+
+    for (i = 0; i < RESIZES && rv == 0; i++) {
+        start();
+        rv = resize(nmemb * 2);
+        rv = rv ? rv : resize(nmemb);
+        stop();
+    }
+    report("resize", RESIZES * 2);
+
+    for (i = 0; i < FLUSHES; i++) {
+        fill(nmemb);
+
+        start();
+        lru_cache_flush(&c);
+        stop();
+    }
+    report("flush", FLUSHES);
+
+    for (i = 0; i < nmemb; i++) {
+        warm[i] = mix(i);
+    }
+
+    for (i = 0; i < FLUSHES && rv == 0; i++) {
+        lru_cache_flush(&c);
+
+        start();
+        rv = lru_cache_bulk_load(&c, warm, nmemb, NULL);
+        stop();
+    }
+    report("bulk_load", (uint64_t)FLUSHES * nmemb);
+
+    perf_counters_close(&counters);
+
+out:
+    free(keys);
+    free(warm);
+    free(hashmap);
+    free(cache);
+    return rv;
+}
+
+static bool lookup(const char *line, const char *key, double *value)
+{
+    char *end;
+    size_t n = strlen(key);
+    const char *p = line;
+
+    while ((p = strstr(p, key)) != NULL) {
+        if ((p == line || p[-1] == ' ') && p[n] == '=') {
+            *value = strtod(p + n + 1, &end);
+            return end != p + n + 1;
+        }
+
+        p += n;
+    }
+
+    return false;
+}
+
+static int compare(const char *base_path, const char *new_path, double threshold)
+{
+    /*
+     * Lines are matched by their op, values by their key. Every value is a cost, so an increase
+     * by more than the threshold is a regression. Counters unavailable in either run are skipped.
+     */
+    FILE *base, *new;
+    char base_line[1024], new_line[1024];
+    char op[64], base_op[64];
+    char *p, *key, *value_str, *end, *save;
+    double value, base_value, delta;
+    int regressions = 0;
+
+    if ((base = fopen(base_path, "r")) == NULL) {
+        perror(base_path);
+        return 2;
+    }
+
+    if ((new = fopen(new_path, "r")) == NULL) {
+        perror(new_path);
+        fclose(base);
+        return 2;
+    }
+
+    printf("%-12s %-14s %14s %14s %9s\n", "op", "metric", "base", "new", "delta");
+
+    while (fgets(new_line, sizeof(new_line), new)) {
+        if (sscanf(new_line, "op=%63s", op) != 1) {
+            continue;
+        }
+
+        rewind(base);
+
+        while ((p = fgets(base_line, sizeof(base_line), base))) {
+            if (sscanf(base_line, "op=%63s", base_op) == 1 && strcmp(op, base_op) == 0) {
+                break;
+            }
+        }
+
+        if (p == NULL) {
+            continue;
+        }
+
+        for (p = new_line; (key = strtok_r(p, " \n", &save)) != NULL; p = NULL) {
+            if (strncmp(key, "op=", 3) == 0 || (value_str = strchr(key, '=')) == NULL) {
+                continue;
+            }
+
+            *value_str++ = '\0';
+            value = strtod(value_str, &end);
+
+            if (end == value_str || !lookup(base_line, key, &base_value) || base_value <= 0.0) {
+                continue;
+            }
+
+            delta = (value - base_value) / base_value * 100.0;
+            regressions += (delta > threshold);
+
+            printf("%-12s %-14s %14.3f %14.3f %+8.2f%%%s\n",
+                op, key, base_value, value, delta, (delta > threshold) ? " REGRESSION" : "");
+        }
+    }
+
+    fclose(base);
+    fclose(new);
+    return regressions > 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rv;
+    int i;
+    uint32_t nmemb = 1u << 20;
+    uint64_t ops = 1ull << 22;
+
+    if (argc >= 4 && strcmp(argv[1], "-c") == 0) {
+        return compare(argv[2], argv[3], (argc > 4) ? strtod(argv[4], NULL) : 5.0);
+    }
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) {
+            nmemb = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0) {
+            ops = strtoull(argv[i + 1], NULL, 10);
+        } else {
+            break;
+        }
+    }
+
+    if (i != argc || nmemb == 0 || ops == 0) {
+        fprintf(stderr, "usage: %s [-n nmemb] [-o ops]\n", argv[0]);
+        fprintf(stderr, "       %s -c base new [threshold_percent]\n", argv[0]);
+        return 2;
+    }
+
+    if ((rv = run(nmemb, ops)) != 0) {
+        fprintf(stderr, "%s\n", strerror(rv));
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#define _DEFAULT_SOURCE
+
+#include "perf-counters.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define HW_CACHE_READ_MISS(CACHE) \
+    ((CACHE) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+const char *const perf_counter_names[PERF_COUNTERS] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_L1D_MISSES] = "l1d_misses",
+    [PERF_LLC_MISSES] = "llc_misses",
+    [PERF_DTLB_MISSES] = "dtlb_misses",
+    [PERF_BRANCH_MISSES] = "branch_misses",
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERF_COUNTERS] = {
+    [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    [PERF_LLC_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PERF_DTLB_MISSES] = { PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+int perf_counters_open(struct perf_counters *p)
+{
+    int i;
+    int n = 0;
+    struct perf_event_attr attr;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        p->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        n += (p->fd[i] >= 0);
+    }
+
+    perf_counters_clear(p);
+    return n;
+}
+
+void perf_counters_close(struct perf_counters *p)
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (p->fd[i] >= 0) {
+            close(p->fd[i]);
+            p->fd[i] = -1;
+        }
+    }
+}
+
+void perf_counters_clear(struct perf_counters *p)
+{
+    memset(p->value, 0, sizeof(p->value));
+}
+
+void perf_counters_start(struct perf_counters *p)
+{
+    int i;
+    uint64_t v[3]; // value, time enabled, time running
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (p->fd[i] < 0) {
+            continue;
+        }
+
+        // PERF_EVENT_IOC_RESET only zeroes the value, the times keep accumulating
+        ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+
+        if (read(p->fd[i], v, sizeof(v)) == sizeof(v)) {
+            p->enabled[i] = v[1];
+            p->running[i] = v[2];
+        } else {
+            p->enabled[i] = 0;
+            p->running[i] = 0;
+        }
+
+        ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_counters_stop(struct perf_counters *p)
+{
+    int i;
+    uint64_t v[3]; // value, time enabled, time running
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (p->fd[i] >= 0) {
+            ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (p->fd[i] < 0 || read(p->fd[i], v, sizeof(v)) != sizeof(v)) {
+            continue;
+        }
+
+        v[1] -= p->enabled[i];
+        v[2] -= p->running[i];
+
+        // Scale up if the counter was multiplexed with others during this interval
+        if (v[2] > 0 && v[2] < v[1]) {
+            v[0] = (uint64_t)((double)v[0] * v[1] / v[2]);
+        }
+
+        p->value[i] += v[0];
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum perf_counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTERS,
+};
+
+/**
+ * @struct perf_counters
+ * @brief Hardware counters of the calling thread, user space only.
+ *
+ * Counters that cannot be opened (no PMU, perf_event_paranoid, seccomp) stay unavailable; all
+ * other counters keep working.
+ */
+struct perf_counters {
+    int fd[PERF_COUNTERS]; ///< perf_event_open descriptor, or -1 if unavailable.
+    uint64_t value[PERF_COUNTERS]; ///< Accumulated counts, scaled for multiplexing.
+    uint64_t enabled[PERF_COUNTERS]; ///< Time enabled when counting started, never reset by the kernel.
+    uint64_t running[PERF_COUNTERS]; ///< Time running when counting started, never reset by the kernel.
+};
+
+extern const char *const perf_counter_names[PERF_COUNTERS];
+
+/**
+ * @brief Opens all counters that are permitted.
+ *
+ * @return The number of available counters.
+ */
+int perf_counters_open(struct perf_counters *p);
+
+void perf_counters_close(struct perf_counters *p);
+
+/**
+ * @brief Sets all accumulated counts to zero.
+ */
+void perf_counters_clear(struct perf_counters *p);
+
+/**
+ * @brief Starts counting from zero.
+ */
+void perf_counters_start(struct perf_counters *p);
+
+/**
+ * @brief Stops counting and adds the counts since `perf_counters_start()` to `value`.
+ */
+void perf_counters_stop(struct perf_counters *p);
+
+static inline bool perf_counter_available(const struct perf_counters *p, enum perf_counter c)
+{
+    return p->fd[c] >= 0;
+}
+
+#endif // PERF_COUNTERS_H_
@@ -0,0 +1,87 @@
+#ifndef LRU_CACHE_ACCESS_H_
+#define LRU_CACHE_ACCESS_H_
+
+#include "lru-cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct lru_cache_access
+ * @brief Striped, lossy buffers of hits to be replayed into the recency order in batches.
+ *
+ * Readers that found an entry without modifying the cache (see `lru_cache_find()`) record its index
+ * in the stripe of their thread. Each stripe is a bounded ring buffer on its own cache lines; when it
+ * is full, the access is dropped, which only makes the recency order slightly less precise. The
+ * writer replays all buffered accesses with `lru_cache_access_drain()` in one write section, so the
+ * number of write sections scales with batches instead of hits.
+ */
+struct lru_cache_access {
+    struct lru_cache *s; ///< Cache whose hits are recorded.
+    void *stripes; ///< Memory of all stripes.
+    size_t stride; ///< Distance between stripes in bytes, a multiple of the cache line size.
+    uint32_t nstripes; ///< Number of stripes.
+    uint32_t mask; ///< Capacity of each stripe minus one.
+    uint32_t next_stripe; ///< Stripe assigned to the next thread that records a hit.
+};
+
+/**
+ * @brief Allocates the buffers.
+ *
+ * @param a Pointer to the buffers.
+ * @param s Pointer to the cache.
+ * @param nstripes Number of stripes, e.g. the number of reader threads.
+ * @param nmemb Capacity of each stripe; must be a power of two.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: `nstripes` is 0 or `nmemb` is not a power of two.
+ *         - ENOMEM: Allocation failed.
+ */
+int lru_cache_access_init(
+    struct lru_cache_access *a,
+    struct lru_cache *s,
+    uint32_t nstripes,
+    uint32_t nmemb);
+
+/**
+ * @brief Releases the buffers, dropping all buffered accesses.
+ *
+ * @param a Pointer to the buffers.
+ */
+void lru_cache_access_free(
+    struct lru_cache_access *a);
+
+/**
+ * @brief Records a hit of entry `i`, without taking a lock. May be called by any thread.
+ *
+ * A thread keeps its stripe while it records into the same buffers; one alternating between several
+ * buffers is assigned the next stripe of each on every switch.
+ *
+ * @param a Pointer to the buffers.
+ * @param i Index of the entry that was found.
+ * @return `true` if the access was buffered, or `false` if it was dropped: either `i` is
+ *         `LRU_CACHE_ENTRY_NIL` or out of range, or the stripe was full and a drain is due.
+ */
+bool lru_cache_access_record(
+    struct lru_cache_access *a,
+    uint32_t i);
+
+/**
+ * @brief Replays buffered accesses with `lru_cache_touch()`, oldest first per stripe.
+ *
+ * Must be called by the writer, within `lru_cache_write_begin()` and `lru_cache_write_end()` if
+ * readers run concurrently.
+ *
+ * @param a Pointer to the buffers.
+ * @param budget Maximum number of accesses to replay.
+ * @return The number of accesses replayed.
+ */
+uint32_t lru_cache_access_drain(
+    struct lru_cache_access *a,
+    uint32_t budget);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LRU_CACHE_ACCESS_H_
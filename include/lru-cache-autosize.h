@@ -0,0 +1,110 @@
+#ifndef LRU_CACHE_AUTOSIZE_H_
+#define LRU_CACHE_AUTOSIZE_H_
+
+#include "lru-cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LRU_CACHE_AUTOSIZE_PSI_PATH "/proc/pressure/memory"
+
+/**
+ * @struct lru_cache_autosize
+ * @brief Controller resizing a cache based on its hit ratio and memory pressure.
+ *
+ * The controller owns the hashmap and cache memory. Cache memory is taken from `aligned_alloc()`
+ * when keys are aligned beyond what `malloc()` guarantees, see `lru_cache_set_align()`. Each call to `lru_cache_autosize_step()`
+ * compares the hit ratio observed since the previous call with the one before. The cache grows by
+ * at most `step` entries while growing keeps improving the hit ratio by `min_gain`, and shrinks by
+ * at most `step` entries while memory is under pressure.
+ *
+ * Memory pressure starts when the PSI "some avg10" value reaches `psi_high` percent, or when
+ * the cgroup memory usage reaches `usage_high` of its limit. It ends only once both have fallen
+ * below `psi_low` and `usage_low`.
+ *
+ * Each step resizes the cache at once with `lru_cache_set_nmemb()`, which rehashes all entries, so
+ * its pause grows with the number of entries: `step` bounds the change of the size, not the time
+ * a step takes. Buckets are not migrated incrementally.
+ *
+ * All fields below `s` except `next_trace` and `next_trace_arg` may be changed between steps.
+ */
+struct lru_cache_autosize {
+    struct lru_cache *s; ///< Cache being resized.
+    void *hashmap; ///< Hashmap memory of the cache.
+    void *cache; ///< Cache memory of the cache.
+    size_t cache_bytes; ///< Size of the cache memory.
+
+    uint32_t min_nmemb; ///< Lower bound for the number of entries.
+    uint32_t max_nmemb; ///< Upper bound for the number of entries.
+    uint32_t step; ///< Maximum change of the number of entries per step.
+    double min_gain; ///< Hit ratio improvement required to keep growing.
+
+    const char *psi_path; ///< PSI file, or NULL to ignore PSI.
+    double psi_high; ///< PSI percentage starting memory pressure.
+    double psi_low; ///< PSI percentage below which memory pressure ends.
+
+    const char *cgroup_path; ///< Directory with memory.current and memory.max, or NULL.
+    double usage_high; ///< Fraction of the cgroup limit starting memory pressure.
+    double usage_low; ///< Fraction of the cgroup limit below which memory pressure ends.
+
+    bool pressure; ///< Whether memory is considered under pressure.
+    bool growing; ///< Whether the previous step grew the cache.
+    double ratio; ///< Hit ratio observed before the previous step, or a negative value.
+
+    uint64_t hits; ///< Hits since the previous step.
+    uint64_t lookups; ///< Lookups since the previous step.
+
+    lru_cache_trace_t next_trace; ///< Trace hook of the cache before the controller was attached.
+    void *next_trace_arg; ///< First argument passed to next_trace.
+};
+
+/**
+ * @brief Allocates memory for `nmemb` entries and attaches the controller to a cache.
+ *
+ * The cache must be initialized and have no memory yet. Its `trace` hook is set to
+ * `lru_cache_autosize_access()` to count hits, which passes every lookup on to the hook set before,
+ * e.g. `lru_cache_trace_record()` or `lru_cache_mrc_access()`. Other hooks must therefore be set
+ * before this call and not afterwards. Bounds default to `nmemb` ... `nmemb * 16`, the step to an
+ * eighth of `nmemb`, and pressure is read from `LRU_CACHE_AUTOSIZE_PSI_PATH`.
+ *
+ * @param a Pointer to the controller.
+ * @param s Pointer to the cache.
+ * @param nmemb Initial number of cache entries.
+ * @return 0 on success, or a positive error number of `lru_cache_set_nmemb()` or ENOMEM.
+ */
+int lru_cache_autosize_init(struct lru_cache_autosize *a, struct lru_cache *s, uint32_t nmemb);
+
+/**
+ * @brief Releases the memory of the cache. The cache must not be used afterwards.
+ *
+ * @param a Pointer to the controller.
+ */
+void lru_cache_autosize_free(struct lru_cache_autosize *a);
+
+/**
+ * @brief Counts a lookup and calls the previous hook; matches `lru_cache_trace_t` with the
+ *        controller as argument.
+ */
+void lru_cache_autosize_access(void *a, const void *key, uint32_t hash, bool hit);
+
+/**
+ * @brief Reads memory pressure and resizes the cache by at most `step` entries.
+ *
+ * Should be called periodically, e.g. once per second, serialized with all other operations on
+ * the cache.
+ *
+ * @param a Pointer to the controller.
+ * @return 0 on success, or a positive error number:
+ *         - EBUSY: The `trace` hook of the cache was replaced, so hits are no longer counted; the
+ *                  size is unchanged.
+ *         - ENOMEM: Memory for growing the cache could not be allocated; the size is unchanged.
+ *         - Any error of `lru_cache_set_nmemb()` or `lru_cache_set_memory()`.
+ */
+int lru_cache_autosize_step(struct lru_cache_autosize *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LRU_CACHE_AUTOSIZE_H_
@@ -0,0 +1,94 @@
+#ifndef LRU_CACHE_LRU2_H_
+#define LRU_CACHE_LRU2_H_
+
+#include "lru-cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct lru_cache_lru2_history
+ * @brief Last access of a recently evicted key.
+ */
+struct lru_cache_lru2_history {
+    uint32_t fingerprint; ///< Hash of the key.
+    uint64_t last; ///< Time of its last access, or 0 if the slot is empty.
+};
+
+/**
+ * @struct lru_cache_lru2
+ * @brief LRU-2 replacement for a cache: the entry whose second most recent access is the oldest
+ *        is evicted.
+ *
+ * Entries accessed only once count as infinitely old, and among them the least recently used one
+ * is evicted, so a scan of keys used once cannot displace keys used repeatedly. Entries are kept in a
+ * binary min-heap ordered by their last two access times, which finds the victim in O(1) and costs
+ * O(log nmemb) per access. The victim is handed to the cache with `lru_cache_demote()`; pinned
+ * entries are passed over for the next one in the heap.
+ *
+ * The last access of evicted keys is remembered in a direct-mapped history table indexed by key
+ * hash, so a key that returns soon after its eviction is not mistaken for one seen only once.
+ *
+ * All lookups must go through `lru_cache_lru2_get_or_put()`. The cache must not be resized while
+ * the policy is attached; free it and initialize it again around `lru_cache_set_memory()`.
+ */
+struct lru_cache_lru2 {
+    struct lru_cache *s; ///< Cache whose victims are chosen.
+    uint32_t nmemb; ///< Number of cache entries when the policy was attached.
+
+    uint64_t now; ///< Logical time, incremented by every access.
+    uint64_t *last; ///< Time of the last access of each entry.
+    uint64_t *prev; ///< Time of the access before the last of each entry, or 0 if none.
+
+    uint32_t *heap; ///< Entry indices, ordered by `prev` and then `last`.
+    uint32_t *pos; ///< Position of each entry in `heap`, or LRU_CACHE_ENTRY_NIL.
+    uint32_t count; ///< Number of entries in `heap`.
+
+    struct lru_cache_lru2_history *history; ///< Evicted keys, indexed by the low bits of their hash.
+    uint32_t history_mask; ///< Number of history slots minus one.
+    uint64_t history_hits; ///< Inserted keys whose previous access was found in the history.
+};
+
+/**
+ * @brief Attaches an LRU-2 policy to a cache with memory.
+ *
+ * @param k Pointer to the policy.
+ * @param s Pointer to the cache.
+ * @param history_nmemb Number of evicted keys to remember; must be a power of two.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: The cache has no entries, or `history_nmemb` is not a power of two.
+ *         - ENOMEM: Allocation failed.
+ */
+int lru_cache_lru2_init(
+    struct lru_cache_lru2 *k,
+    struct lru_cache *s,
+    uint32_t history_nmemb);
+
+/**
+ * @brief Releases the memory of a policy. The cache itself is left unchanged.
+ *
+ * @param k Pointer to the policy.
+ */
+void lru_cache_lru2_free(
+    struct lru_cache_lru2 *k);
+
+/**
+ * @brief Same as `lru_cache_get_or_put()`, but evicts by LRU-2.
+ *
+ * @param k Pointer to the policy.
+ * @param key Pointer to the key.
+ * @param put If non-NULL, a missing key is inserted and `*put` set to whether it was.
+ * @return The index of the entry, or `LRU_CACHE_ENTRY_NIL` if the key was not found and not
+ *         inserted.
+ */
+uint32_t lru_cache_lru2_get_or_put(
+    struct lru_cache_lru2 *k,
+    const void *key,
+    bool *put);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LRU_CACHE_LRU2_H_
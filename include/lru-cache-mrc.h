@@ -0,0 +1,103 @@
+#ifndef LRU_CACHE_MRC_H_
+#define LRU_CACHE_MRC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct lru_cache_mrc
+ * @brief Online miss ratio curve estimator using spatially hashed sampling (SHARDS).
+ *
+ * Keys whose hash falls below a threshold are sampled, so every access to a sampled key is seen.
+ * For each sampled access, the number of distinct sampled keys accessed since the previous access
+ * to the same key (the reuse distance) is counted with a Fenwick tree over access times. Divided by
+ * the sampling rate, this is the smallest LRU capacity for which the access would have been a hit.
+ *
+ * At most `capacity` sampled keys are tracked; the least recently accessed one is forgotten when a
+ * new key is sampled, so capacities above `capacity / rate` cannot be estimated.
+ */
+struct lru_cache_mrc {
+    double rate; ///< Fraction of keys sampled.
+    uint32_t threshold; ///< Keys are sampled if the upper 24 bits of their hash are below this value.
+
+    uint32_t capacity; ///< Maximum number of tracked keys.
+    uint32_t nkeys; ///< Number of tracked keys.
+
+    uint32_t window; ///< Number of access times before they are renumbered.
+    uint32_t now; ///< Time of the next sampled access.
+    uint32_t oldest; ///< No tracked key was accessed before this time.
+
+    uint32_t mask; ///< Size of the key table minus one.
+    uint64_t *hashes; ///< Hashes of tracked keys, open addressing with linear probing.
+    uint32_t *times; ///< Time of the last access to each tracked key, or LRU_CACHE_ENTRY_NIL.
+
+    uint32_t *owner; ///< Key table slot accessed at each time, or LRU_CACHE_ENTRY_NIL.
+    uint32_t *tree; ///< Fenwick tree counting the last accesses of tracked keys per time.
+
+    uint64_t *histogram; ///< Number of sampled accesses per reuse distance.
+    uint64_t cold; ///< Number of sampled accesses to untracked keys.
+    uint64_t samples; ///< Number of sampled accesses.
+};
+
+/**
+ * @brief Allocates and initializes an estimator.
+ *
+ * @param m Pointer to the estimator.
+ * @param rate Fraction of keys to sample, in (0, 1].
+ * @param capacity Maximum number of sampled keys to track.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: Invalid `rate` or `capacity`.
+ *         - ENOMEM: Allocation failed.
+ */
+int lru_cache_mrc_init(struct lru_cache_mrc *m, double rate, uint32_t capacity);
+
+/**
+ * @brief Releases the memory of an estimator.
+ *
+ * @param m Pointer to the estimator.
+ */
+void lru_cache_mrc_free(struct lru_cache_mrc *m);
+
+/**
+ * @brief Records an access to a key with the given 64-bit hash.
+ *
+ * @param m Pointer to the estimator.
+ * @param hash Hash of the key whose upper 24 bits are uniformly distributed.
+ */
+void lru_cache_mrc_access_hash(struct lru_cache_mrc *m, uint64_t hash);
+
+/**
+ * @brief Records an access to a key, using the hash computed by the cache.
+ *
+ * Matches `lru_cache_trace_t`; assign it to `lru_cache::trace` with the estimator as
+ * `lru_cache::trace_arg` to observe all lookups of a cache. The key itself is not read, so the
+ * cost of an unsampled lookup is a few multiplications. Keys with the same 32-bit hash count as one
+ * key, and a reseed of the built-in hash makes all keys look new. Together with
+ * `lru_cache_autosize_init()`, which installs its own hook, the estimator must be set first.
+ *
+ * @param m Pointer to the estimator.
+ * @param key Unused.
+ * @param hash Hash of the key computed by the cache.
+ * @param hit Unused.
+ */
+void lru_cache_mrc_access(void *m, const void *key, uint32_t hash, bool hit);
+
+/**
+ * @brief Estimates the hit ratio of an LRU cache with `nmemb` entries.
+ *
+ * @param m Pointer to the estimator.
+ * @param nmemb Hypothetical number of cache entries.
+ * @return The estimated fraction of lookups that would have been hits.
+ */
+double lru_cache_mrc_hit_ratio(const struct lru_cache_mrc *m, uint64_t nmemb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LRU_CACHE_MRC_H_
@@ -0,0 +1,122 @@
+#ifndef LRU_CACHE_TIER_H_
+#define LRU_CACHE_TIER_H_
+
+#include "lru-cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @enum lru_cache_tier_hit
+ * @brief Tier that served a lookup of `lru_cache_tier_get_or_put()`.
+ */
+enum lru_cache_tier_hit {
+    LRU_CACHE_TIER_MISS, ///< Key was in neither tier.
+    LRU_CACHE_TIER_HOT, ///< Key was found in the hot tier.
+    LRU_CACHE_TIER_COLD, ///< Key was found in the cold tier and promoted to the hot tier.
+};
+
+/**
+ * @struct lru_cache_tier
+ * @brief Two caches composed into a small hot tier over a large cold tier.
+ *
+ * Both caches store records of the same size in their entries: the key, followed by the data
+ * associated with it. Their hash and comparison functions must only consider the key part, so a
+ * record can be looked up by its key alone and moved between tiers with a single copy.
+ *
+ * Entries evicted from the hot tier are not destroyed right away. They are collected in its eviction
+ * ring buffer (see `lru_cache_set_evictions()`) and demoted to the cold tier in batches by
+ * `lru_cache_tier_writeback()`. The cold tier is inclusive: promoting a record leaves its cold copy in
+ * place, and a demotion only writes to the cold tier if the record has changed since.
+ *
+ * The cold tier's `cache` memory may be a file mapping from `lru_cache_tier_map()`.
+ */
+struct lru_cache_tier {
+    struct lru_cache *hot; ///< Small cache serving all hits.
+    struct lru_cache *cold; ///< Large cache receiving evicted records.
+
+    uint64_t demotions; ///< Records written to the cold tier.
+    uint64_t promotions; ///< Records copied from the cold tier to the hot tier.
+};
+
+/**
+ * @brief Composes two caches with memory into tiers.
+ *
+ * @param t Pointer to the tiers.
+ * @param hot Pointer to the hot cache.
+ * @param cold Pointer to the cold cache.
+ * @param evictions Ring buffer memory for `nmemb` entry indices, the batch size of demotions.
+ * @param nmemb Capacity of the ring buffer; should be well below the number of hot entries.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: The record sizes differ, or `evictions` is NULL or `nmemb` is 0.
+ */
+int lru_cache_tier_init(
+    struct lru_cache_tier *t,
+    struct lru_cache *hot,
+    struct lru_cache *cold,
+    uint32_t *evictions,
+    uint32_t nmemb);
+
+/**
+ * @brief Looks up a key in both tiers, inserting it into the hot tier on a miss.
+ *
+ * On a miss in the hot tier, pending evictions are demoted first, so the cold tier holds the latest
+ * version of every record and no record is lost to the eviction ring buffer overflowing. Records
+ * found in the cold tier are then copied into the hot tier.
+ *
+ * @param t Pointer to the tiers.
+ * @param key Pointer to a record; only its key part needs to be set unless it is inserted.
+ * @param put If non-NULL, a missing key is inserted and `*put` set to whether it was. If NULL,
+ *            a missing key is not inserted.
+ * @param hit Set to the tier that served the lookup.
+ * @return The index of the record in the hot tier, or `LRU_CACHE_ENTRY_NIL` if it was not found
+ *         and not inserted.
+ */
+uint32_t lru_cache_tier_get_or_put(
+    struct lru_cache_tier *t,
+    const void *key,
+    bool *put,
+    enum lru_cache_tier_hit *hit);
+
+/**
+ * @brief Demotes pending evictions of the hot tier to the cold tier, oldest first.
+ *
+ * @param t Pointer to the tiers.
+ * @param budget Maximum number of records to demote.
+ * @return The number of records demoted.
+ */
+uint32_t lru_cache_tier_writeback(
+    struct lru_cache_tier *t,
+    uint32_t budget);
+
+/**
+ * @brief Maps a file of `bytes` bytes for use as cache memory, creating or extending it.
+ *
+ * The mapping is shared, so demoted records are written back to the file by the kernel. Readahead is
+ * disabled because lookups access entries at random.
+ *
+ * @param path Path of the file, ideally on local flash storage.
+ * @param bytes Size of the mapping, e.g. the `cache_bytes` of `lru_cache_set_nmemb()`.
+ * @param addr Set to the start of the mapping.
+ * @return 0 on success, or the errno of the failed open, ftruncate or mmap call.
+ */
+int lru_cache_tier_map(
+    const char *path,
+    size_t bytes,
+    void **addr);
+
+/**
+ * @brief Writes a mapping from `lru_cache_tier_map()` back to its file and removes it.
+ *
+ * @return 0 on success, or the errno of the failed msync or munmap call.
+ */
+int lru_cache_tier_unmap(
+    void *addr,
+    size_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LRU_CACHE_TIER_H_
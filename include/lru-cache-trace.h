@@ -0,0 +1,94 @@
+#ifndef LRU_CACHE_TRACE_H_
+#define LRU_CACHE_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LRU_CACHE_TRACE_MAGIC "LRUTRACE"
+#define LRU_CACHE_TRACE_BUFFER_NMEMB 4096
+
+#define LRU_CACHE_TRACE_HIT(R) ((bool)((R)->stamp & 1))
+#define LRU_CACHE_TRACE_TIME(R) ((R)->stamp >> 1)
+
+/**
+ * @struct lru_cache_trace_record
+ * @brief A single lookup as stored in a trace file.
+ *
+ * A trace file consists of `LRU_CACHE_TRACE_MAGIC` (without terminator) followed by records in
+ * host byte order. Records of one thread are in order; records of different threads are
+ * interleaved in blocks of up to `LRU_CACHE_TRACE_BUFFER_NMEMB`.
+ */
+struct lru_cache_trace_record {
+    uint64_t hash; ///< Hash of the key computed by the cache; keys with the same hash are one key.
+    uint64_t stamp; ///< CLOCK_MONOTONIC time in nanoseconds shifted left by one, ORed with the hit flag.
+};
+
+/**
+ * @struct lru_cache_trace
+ * @brief An open trace file.
+ *
+ * Each cache to be traced gets its own; records of the calling thread are buffered in thread-local
+ * storage shared by all traces and written out when the thread records a lookup for another trace.
+ */
+struct lru_cache_trace {
+    int fd; ///< File descriptor of the trace file, or -1 if not open.
+};
+
+/**
+ * @brief Creates or truncates a trace file.
+ *
+ * Must be called before any thread records lookups.
+ *
+ * @param t Pointer to the trace.
+ * @param path Path of the trace file.
+ * @return 0 on success, or a positive error number of open(2) or write(2), in which case
+ *         `lru_cache_trace::fd` is -1.
+ */
+int lru_cache_trace_open(struct lru_cache_trace *t, const char *path);
+
+/**
+ * @brief Records a lookup in the buffer of the calling thread.
+ *
+ * Matches `lru_cache_trace_t`; assign it to `lru_cache::trace` with the trace as
+ * `lru_cache::trace_arg`, before `lru_cache_autosize_init()`, which installs its own hook, if both
+ * are used. The buffer is written to the trace file when it is full; no locks are taken.
+ *
+ * @param t Pointer to the trace.
+ * @param key Unused.
+ * @param hash Hash of the key computed by the cache.
+ * @param hit Whether the key was found.
+ */
+void lru_cache_trace_record(void *t, const void *key, uint32_t hash, bool hit);
+
+/**
+ * @brief Writes the buffered records of the calling thread to the trace file.
+ *
+ * Every thread that recorded lookups must call this before it exits or the trace is closed.
+ *
+ * @param t Pointer to the trace.
+ * @return 0 on success, or a positive error number:
+ *         - EBADF: The trace is not open.
+ *         - Any error of write(2).
+ */
+int lru_cache_trace_flush(struct lru_cache_trace *t);
+
+/**
+ * @brief Flushes the calling thread and closes the trace file.
+ *
+ * @param t Pointer to the trace.
+ * @return 0 on success, or a positive error number:
+ *         - EBADF: The trace is not open.
+ *         - Any error of write(2) or close(2).
+ */
+int lru_cache_trace_close(struct lru_cache_trace *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LRU_CACHE_TRACE_H_
@@ -0,0 +1,159 @@
+#ifndef LRU_CACHE_WRITEBACK_H_
+#define LRU_CACHE_WRITEBACK_H_
+
+#include "lru-cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @typedef lru_cache_write_t
+ * @brief Function pointer type for writing dirty entries back to the backing store.
+ *
+ * Called with the indices of up to `batch_nmemb` dirty entries, least recently used first. The keys
+ * are available through `lru_cache_get_entry()`, but the cache must not be looked up or modified.
+ * Must return 0 once all entries are written, or a non-zero value to leave all of them dirty.
+ */
+typedef int (*lru_cache_write_t)(void *arg, struct lru_cache *s, const uint32_t *indices, uint32_t n);
+
+/**
+ * @struct lru_cache_writeback
+ * @brief Write-back of modified entries, in batches, before they leave the cache.
+ *
+ * Entries marked with `lru_cache_writeback_mark_dirty()` are written back when they are about to be
+ * evicted. The victim is written together with the dirty entries that follow it toward the MRU end,
+ * which would be evicted next, so N small writes become about N / `batch_nmemb` calls of `write`.
+ * Calling `lru_cache_writeback()` when idle cleans the LRU end ahead of time, so misses rarely
+ * wait for the store.
+ *
+ * All insertions must go through `lru_cache_writeback_get_or_put()`, and flushes through
+ * `lru_cache_writeback_flush()`; `lru_cache_flush()` and `lru_cache_flush_lazy()` would discard
+ * dirty entries. The cache must not defer evictions with `lru_cache_set_evictions()`, and must not
+ * be resized while write-back is attached. Call `lru_cache_writeback_sync()` before shutdown.
+ */
+struct lru_cache_writeback {
+    struct lru_cache *s; ///< Cache whose entries are written back.
+    uint32_t nmemb; ///< Number of cache entries when write-back was attached.
+
+    uint64_t *dirty; ///< Bit per entry, set if the entry was modified since it was last written.
+    uint32_t ndirty; ///< Number of bits set in `dirty`.
+
+    uint32_t *batch; ///< Indices of the batch being written.
+    uint32_t batch_nmemb; ///< Maximum number of entries per call of `write`.
+
+    lru_cache_write_t write; ///< Writes batches of dirty entries.
+    void *arg; ///< First argument passed to write.
+
+    uint64_t batches; ///< Number of successful calls of `write`.
+    uint64_t written; ///< Number of entries written by them.
+    uint64_t errors; ///< Number of calls of `write` that failed.
+};
+
+/**
+ * @brief Attaches write-back to a cache with memory. All entries start clean.
+ *
+ * @param w Pointer to the write-back state.
+ * @param s Pointer to the cache.
+ * @param batch_nmemb Maximum number of entries per call of `write`.
+ * @param write Function writing batches of dirty entries.
+ * @param arg First argument passed to `write`.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: The cache has no entries, defers evictions or is being resized, `batch_nmemb`
+ *                   is 0 or `write` is NULL.
+ *         - ENOMEM: Allocation failed.
+ */
+int lru_cache_writeback_init(
+    struct lru_cache_writeback *w,
+    struct lru_cache *s,
+    uint32_t batch_nmemb,
+    lru_cache_write_t write,
+    void *arg);
+
+/**
+ * @brief Releases the memory of the write-back state, discarding dirty bits. The cache itself is
+ *        left unchanged.
+ *
+ * @param w Pointer to the write-back state.
+ */
+void lru_cache_writeback_free(
+    struct lru_cache_writeback *w);
+
+/**
+ * @brief Same as `lru_cache_get_or_put()`, but writes back a dirty victim before evicting it.
+ *
+ * Inserted entries are clean.
+ *
+ * @param w Pointer to the write-back state.
+ * @param key Pointer to the key.
+ * @param put If non-NULL, a missing key is inserted and `*put` set to whether it was.
+ * @return The index of the entry, or `LRU_CACHE_ENTRY_NIL` if the key was not found and not
+ *         inserted: writing back the victim failed, or the cache was resized or set to defer
+ *         evictions after write-back was attached.
+ */
+uint32_t lru_cache_writeback_get_or_put(
+    struct lru_cache_writeback *w,
+    const void *key,
+    bool *put);
+
+/**
+ * @brief Marks an entry as modified, to be written back before it leaves the cache.
+ *
+ * @param w Pointer to the write-back state.
+ * @param i Index of a cached entry.
+ */
+void lru_cache_writeback_mark_dirty(
+    struct lru_cache_writeback *w,
+    uint32_t i);
+
+/**
+ * @brief Returns whether an entry is modified and not yet written back.
+ *
+ * @param w Pointer to the write-back state.
+ * @param i Index of an entry.
+ */
+bool lru_cache_writeback_is_dirty(
+    const struct lru_cache_writeback *w,
+    uint32_t i);
+
+/**
+ * @brief Writes back dirty entries among the `budget` least recently used entries.
+ *
+ * Does nothing until the cache is full, since no entry is evicted before.
+ *
+ * @param w Pointer to the write-back state.
+ * @param budget Maximum number of entries to examine, from the LRU end.
+ * @return The number of entries written back. Stops early if `write` fails.
+ */
+uint32_t lru_cache_writeback(
+    struct lru_cache_writeback *w,
+    uint32_t budget);
+
+/**
+ * @brief Writes back all dirty entries: those in the recency order from LRU to MRU, then pinned
+ *        entries. Dirty bits of entries invalidated by a flush are discarded.
+ *
+ * When it returns 0, no entry is dirty, so everything written before the call is in the store.
+ *
+ * @param w Pointer to the write-back state.
+ * @return 0 on success, or the non-zero value returned by `write`; the entries of the failed batch
+ *         and all later ones are left dirty.
+ */
+int lru_cache_writeback_sync(
+    struct lru_cache_writeback *w);
+
+/**
+ * @brief Writes back all dirty entries, then flushes the cache with `lru_cache_flush()`.
+ *
+ * @param w Pointer to the write-back state.
+ * @return 0 on success, or the non-zero value returned by `write`, in which case the cache is not
+ *         flushed and the entries not yet written stay dirty.
+ */
+int lru_cache_writeback_flush(
+    struct lru_cache_writeback *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LRU_CACHE_WRITEBACK_H_
@@ -7,14 +7,36 @@
 #include <stdbool.h>
 #include <sys/types.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define LRU_CACHE_ITERATE_MRU_TO_LRU(C, I, E) \
-    for ((I) = (C)->mru; (E = lru_cache_get_entry((C), (I))) && (E)->clru != (I); ) \
+    for ((I) = (C)->mru; (E = lru_cache_get_entry((C), (I))) && (E)->clru != (I) && (I) != (C)->stale; ) \
         for (uint32_t __TMP = (E)->lru, __ITR = 0; !__ITR; (I) = __TMP, __ITR++)
 
 #define LRU_CACHE_ENTRY_NIL UINT32_MAX
+#define LRU_CACHE_LOAD_FACTOR_DEFAULT 100
+#define LRU_CACHE_MAX_CHAIN_DEFAULT 16
+#define LRU_CACHE_PIN_LIMIT_DEFAULT 50
+#define LRU_CACHE_ALIGN_MAX 4096
 #define LRU_CACHE_FNV1A64_IV 0xcbf29ce484222325ull
 #define LRU_CACHE_DJB2_IV 5381ull
 
+// Lets the C++ wrapper size its storage with the inline functions below at compile time
+#ifdef __cplusplus
+#define LRU_CACHE_CONSTEXPR constexpr
+#else
+#define LRU_CACHE_CONSTEXPR
+#endif
+
+/**
+ * Bytes of hashmap memory per bucket: the index of the first entry of its collision chain, and a
+ * 16-bit filter of the tags (four bits of the mixed hash) of the keys in the chain. Filters are stored after
+ * all chain heads, so misses are mostly rejected without touching an entry.
+ */
+#define LRU_CACHE_BUCKET_SIZE (sizeof(uint32_t) + sizeof(uint16_t))
+
 /**
  * @struct lru_cache_entry
  * @brief Structure representing an entry in the LRU cache.
@@ -42,6 +64,25 @@ struct lru_cache_entry {
  */
 typedef void (*lru_cache_destroy_t)(void *a, uint32_t index);
 
+/**
+ * @typedef lru_cache_load_t
+ * @brief Function pointer type for loading the data of a missing key.
+ *
+ * Called by `lru_cache_get_or_load()` with the key and the index of the entry reserved for it.
+ * Must return 0 on success, or a non-zero value if the key could not be loaded.
+ */
+typedef int (*lru_cache_load_t)(const void *key, uint32_t index);
+
+/**
+ * @enum lru_cache_load_state
+ * @brief Outcome of `lru_cache_load_begin()`.
+ */
+enum lru_cache_load_state {
+    LRU_CACHE_LOAD_HIT, ///< Key is cached and loaded.
+    LRU_CACHE_LOAD_MISS, ///< Key was inserted, the caller must load it and call lru_cache_load_end.
+    LRU_CACHE_LOAD_PENDING, ///< Key is being loaded by another caller.
+};
+
 /**
  * @typedef lru_cache_compare_t
  * @brief Function pointer type for comparing keys.
@@ -54,10 +95,22 @@ typedef int (*lru_cache_compare_t)(const void *a, const void *b);
  * @typedef lru_cache_hash_t
  * @brief Function pointer type for hashing keys.
  *
- * This function generates a hash value for a given key, which is used to
- * determine the index in the hashmap.
+ * This function generates a 32-bit hash value for a given key. The cache reduces it to a bucket
+ * of the hashmap by masking, so the low bits of the hash must be well distributed. The tags of the
+ * bucket filters are taken from a multiplicative mix of all bits, so they need no extra care.
  */
-typedef uint32_t (*lru_cache_hash_t)(const void *a, uint32_t nmemb);
+typedef uint32_t (*lru_cache_hash_t)(const void *a);
+
+/**
+ * @typedef lru_cache_trace_t
+ * @brief Function pointer type for observing lookups.
+ *
+ * Called by `lru_cache_get_or_put()` for every lookup with `lru_cache::trace_arg`, the key, the hash
+ * the cache computed for it and whether it was found. The hash of a key changes when the built-in
+ * hash is reseeded. A cache has a single hook; `lru_cache_autosize_init()` installs its own and
+ * chains to the one set before.
+ */
+typedef void (*lru_cache_trace_t)(void *arg, const void *key, uint32_t hash, bool hit);
 
 /**
  * @struct lru_cache
@@ -68,11 +121,11 @@ typedef uint32_t (*lru_cache_hash_t)(const void *a, uint32_t nmemb);
  * ordering, and references to the hashmap and cache memory.
  */
 struct lru_cache {
-    uint32_t *hashmap; ///< Hashmap for quick access to cache entries.
+    uint32_t *hashmap; ///< Chain heads of all buckets, followed by their tag filters.
     void *cache; ///< Pointer to the cache memory.
 
     lru_cache_hash_t hash; ///< Hash function for the cache keys.
-    lru_cache_compare_t compare; ///< Comparison function for cache keys.
+    lru_cache_compare_t compare; ///< Comparison function for cache keys, or NULL to compare bytes.
     lru_cache_destroy_t destroy; ///< Function to destroy cache entries.
 
     uint16_t psel;
@@ -80,16 +133,49 @@ struct lru_cache {
     uint8_t leader_set_size;
 
     uint32_t size; ///< Size of each cache entry.
+    uint32_t align; ///< Alignment of the keys, see lru_cache_set_align.
     uint32_t nmemb; ///< Number of cache entries.
     uint32_t try_nmemb; //< Size requested through lru_cache_set_nmemb.
+    uint32_t nbuckets; ///< Number of hashmap buckets, a power of two.
+    uint32_t try_nbuckets; ///< Number of hashmap buckets for try_nmemb.
+    uint32_t load_factor; ///< Maximum number of entries per 100 buckets.
 
     uint32_t lru; ///< Pointer to the least recently used entry.
     uint32_t mru; ///< Pointer to the most recently used entry.
+    uint32_t stale; ///< Most recently used entry invalidated by lru_cache_flush_lazy.
+
+    uint32_t *evictions; ///< Ring buffer of evicted entries awaiting destroy.
+    uint32_t evictions_nmemb; ///< Capacity of the eviction ring buffer.
+    uint32_t evictions_head; ///< Position of the oldest pending eviction.
+    uint32_t evictions_count; ///< Number of pending evictions.
+
+    uint32_t loading; ///< Number of entries between lru_cache_load_begin and lru_cache_load_end.
+    uint32_t pinned; ///< Number of entries pinned by lru_cache_pin.
+    uint32_t pin_limit; ///< Maximum percentage of nmemb that may be pinned.
+
+    lru_cache_trace_t trace; ///< Optional lookup observer, e.g. lru_cache_trace_record.
+    void *trace_arg; ///< First argument passed to trace.
+
+    uint64_t seed[2]; ///< Random key of the built-in hash, used if hash is NULL.
+    uint32_t max_chain; ///< Chain length above the average that makes the built-in hash reseed.
+    uint32_t reseeds; ///< Number of reseeds triggered by max_chain.
+
+    uint32_t seq; ///< Sequence count for concurrent readers, odd while the writer modifies the cache.
 };
 
 uint64_t lru_cache_fnv1a64_step(uint64_t state, const void *data, size_t size);
 uint64_t lru_cache_djb2_step(uint64_t state, const void *data, size_t size);
 
+/**
+ * @brief Keyed SipHash-1-3 of `size` bytes.
+ *
+ * @param key 128-bit secret key.
+ * @param data Data to be hashed.
+ * @param size Number of bytes of `data`.
+ * @return The 64-bit hash value.
+ */
+uint64_t lru_cache_siphash13(const uint64_t key[2], const void *data, size_t size);
+
 bool lru_cache_is_full(
     struct lru_cache *s);
 
@@ -101,10 +187,92 @@ uint32_t lru_cache_update_entry(
     uint32_t old_hash,
     uint32_t new_hash);
 
+/**
+ * @brief Rounds a key size up for the given alignment.
+ *
+ * Up to the 16-byte entry header, the size is rounded up to a multiple of `align`. Beyond it, the
+ * size is padded so that the whole entry, header and key, is a multiple of `align`, which lets
+ * `lru_cache_set_align()` place every key on a cache line or vector boundary.
+ *
+ * @param size Size of the keys.
+ * @param align Power of two, at most `LRU_CACHE_ALIGN_MAX`.
+ * @param aligned_size_ Optional pointer to store the rounded size.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: `size` is 0 or `align` is not a power of two up to `LRU_CACHE_ALIGN_MAX`.
+ *         - EOVERFLOW: The rounded size does not fit in 32 bits.
+ */
 int lru_cache_align(uint32_t size, uint32_t align, uint32_t *aligned_size_);
 
-int lru_cache_calc_sizes(size_t aligned_size, size_t nmemb, size_t *hashmap_bytes, size_t *cache_bytes);
+/**
+ * @brief Returns the number of hashmap buckets used for `nmemb` entries.
+ *
+ * The smallest power of two that keeps `nmemb` entries at or below `load_factor` entries per 100
+ * buckets, at most 2^31. A `load_factor` of 0 selects `LRU_CACHE_LOAD_FACTOR_DEFAULT`.
+ */
+static inline LRU_CACHE_CONSTEXPR uint32_t lru_cache_calc_nbuckets(uint32_t nmemb, uint32_t load_factor)
+{
+    uint32_t nbuckets = 1;
+    uint64_t min_nbuckets = (uint64_t)nmemb * 100;
+
+    if (load_factor == 0) {
+        load_factor = LRU_CACHE_LOAD_FACTOR_DEFAULT;
+    }
+
+    min_nbuckets = (min_nbuckets + load_factor - 1) / load_factor;
+
+    while (nbuckets < min_nbuckets && nbuckets < (UINT32_C(1) << 31)) {
+        nbuckets <<= 1;
+    }
+
+    return nbuckets;
+}
+
+/**
+ * @brief Returns the tag filters of a hashmap, stored after its `nbuckets` chain heads.
+ */
+static inline uint16_t *lru_cache_get_tags(uint32_t *hashmap, uint32_t nbuckets)
+{
+    return (uint16_t *)(hashmap + nbuckets);
+}
+
+/**
+ * @brief Returns the bit a key with hash `hash` sets in the tag filter of its bucket.
+ *
+ * Buckets use the low bits of the hash, so the tag takes the top bits of a multiplicative mix of all
+ * of them.
+ */
+static inline uint16_t lru_cache_tag(uint32_t hash)
+{
+    return (uint16_t)(1u << ((hash * 0x9e3779b1u) >> 28));
+}
+
+int lru_cache_calc_sizes(
+    size_t aligned_size,
+    size_t nmemb,
+    uint32_t load_factor,
+    size_t *hashmap_bytes,
+    size_t *cache_bytes);
 
+/**
+ * @brief Initializes a cache without memory.
+ *
+ * If `hash` is NULL, keys are hashed with `lru_cache_siphash13()` over all `aligned_size` bytes
+ * using a random key per cache, so collisions cannot be precomputed from untrusted keys. A lookup
+ * walking more than `max_chain` entries beyond the average chain length then chooses a new key
+ * and rehashes all entries.
+ *
+ * If `compare` is NULL, keys are equal if all their `aligned_size` bytes are, compared 32 bytes at a
+ * time so that compilers emit vector compares; padding added by `lru_cache_align()` must then be
+ * zeroed. This fast path only applies when `compare` is NULL, a comparison function is always
+ * called through its pointer.
+ *
+ * @param s Pointer to the `lru_cache` structure to be initialized.
+ * @param aligned_size Size of the keys, see `lru_cache_align()`.
+ * @param hash Hash function, or NULL for the built-in keyed hash.
+ * @param compare Comparison function, or NULL to compare the bytes of the keys.
+ * @param destroy Optional function called for entries leaving the cache.
+ * @return 0 on success, or EINVAL for a size of 0.
+ */
 int lru_cache_init(
     struct lru_cache *s,
     uint32_t aligned_size,
@@ -112,6 +280,26 @@ int lru_cache_init(
     lru_cache_compare_t compare,
     lru_cache_destroy_t destroy);
 
+/**
+ * @brief Aligns every key in the cache memory to `align` bytes, e.g. 64 for cache lines or 32 for
+ *        AVX2 loads.
+ *
+ * The cache memory passed to `lru_cache_set_memory()` must then be aligned to `align` bytes, and
+ * `lru_cache_set_nmemb()` adds the padding that puts the first key, after its entry header, on the
+ * boundary. Must be called before the first `lru_cache_set_nmemb()`. Aligned keys only speed up
+ * the built-in byte comparison, i.e. when `lru_cache_init()` was given a NULL `compare`.
+ *
+ * @param s Pointer to the cache.
+ * @param align Power of two, at most `LRU_CACHE_ALIGN_MAX`.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: `align` is not a power of two up to `LRU_CACHE_ALIGN_MAX`, or the entry size is
+ *           not a multiple of it; see `lru_cache_align()`.
+ *         - EBUSY: The number of entries was already set.
+ */
+int lru_cache_set_align(
+    struct lru_cache *s,
+    uint32_t align);
+
 /**
  * @brief Sets the number of cache entries and calculates required memory sizes.
  *
@@ -129,6 +317,8 @@ int lru_cache_init(
  * @return 0 on success, or a positive error number:
  *         - EINVAL: Invalid `nmemb` value.
  *         - EOVERFLOW: Overflow detected while calculating memory requirements.
+ *         - EBUSY: Shrinking would drop an entry being loaded or pinned, or leave no entry besides
+ *                  them; see `lru_cache_load_begin()`. Entries of the new size are never moved.
  */
 int lru_cache_set_nmemb(
     struct lru_cache *s,
@@ -158,6 +348,40 @@ int lru_cache_set_memory(
     void *hashmap,
     void *cache);
 
+/**
+ * @brief Changes the load factor and calculates the memory size of the resized hashmap.
+ *
+ * The hashmap is resized independently of the entries: the new memory must be provided through
+ * `lru_cache_set_hashmap()`. A lower load factor trades hashmap memory for shorter collision
+ * chains. The load factor also applies to all later calls of `lru_cache_set_nmemb()`.
+ *
+ * @param s Pointer to the `lru_cache` structure to be modified.
+ * @param load_factor Maximum number of entries per 100 buckets, e.g. 50 for two buckets per entry.
+ * @param hashmap_bytes Pointer to store the required bytes for the hashmap memory.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: `load_factor` is 0.
+ *         - EBUSY: A resize through `lru_cache_set_nmemb()` has not been completed yet.
+ */
+int lru_cache_set_load_factor(
+    struct lru_cache *s,
+    uint32_t load_factor,
+    size_t *hashmap_bytes);
+
+/**
+ * @brief Moves the cache to new hashmap memory sized by `lru_cache_set_load_factor()`.
+ *
+ * All entries are rehashed into `hashmap`, the previous hashmap memory is not accessed and may be
+ * released afterwards.
+ *
+ * @param s Pointer to the `lru_cache` structure to be modified.
+ * @param hashmap Pointer to the allocated hashmap memory.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: `hashmap` is NULL.
+ */
+int lru_cache_set_hashmap(
+    struct lru_cache *s,
+    void *hashmap);
+
 /**
  * @brief Retrieves a pointer to a cache entry at a given index.
  *
@@ -173,6 +397,47 @@ struct lru_cache_entry *lru_cache_get_entry(
 
 uint32_t lru_cache_put(struct lru_cache *s, const void *key);
 
+/**
+ * @brief Defers the `destroy` calls of evicted entries to `lru_cache_drain_evictions()`.
+ *
+ * When the cache runs out of free entries, `lru_cache_put()` moves up to `nmemb` entries from the
+ * LRU end into the ring buffer. They are no longer found by lookups, but their slots are not reused
+ * until their eviction has been completed, so data associated with the entry index stays valid for
+ * the `destroy` function. If the ring buffer is not drained in time, `lru_cache_put()` completes the
+ * oldest pending eviction itself.
+ *
+ * The ring buffer is refilled after every insertion, so a full cache holds at most `s->nmemb - nmemb`
+ * keys, also right after a drain, whose slots are then free. A buffer sized for the insertions
+ * between two drains defers every `destroy` call; a larger one only costs capacity.
+ *
+ * Pending evictions of the previous ring buffer are completed before switching buffers. Passing a
+ * NULL buffer and `nmemb` 0 restores eviction inside `lru_cache_put()`.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param evictions Ring buffer memory for `nmemb` entry indices.
+ * @param nmemb Capacity of the ring buffer.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: `evictions` is NULL while `nmemb` is not 0.
+ */
+int lru_cache_set_evictions(
+    struct lru_cache *s,
+    uint32_t *evictions,
+    uint32_t nmemb);
+
+/**
+ * @brief Completes pending evictions, oldest first.
+ *
+ * Calls the `destroy` function for up to `budget` pending evictions and makes their slots available
+ * to `lru_cache_put()` again. Calls must be serialized with all other operations on the cache.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param budget Maximum number of evictions to complete.
+ * @return The number of evictions completed.
+ */
+uint32_t lru_cache_drain_evictions(
+    struct lru_cache *s,
+    uint32_t budget);
+
 /**
  * @brief Retrieves or inserts a cache entry based on the provided key.
  *
@@ -203,16 +468,300 @@ uint32_t lru_cache_get_or_put(
     const void *key,
     bool *put);
 
+/**
+ * @brief Looks up a key like `lru_cache_get_or_put()` with a NULL `put`, and returns its hash.
+ *
+ * Together with `lru_cache_put_hashed()`, a replacement policy can act between a miss and the
+ * insertion, e.g. demote or write back the victim, while the key is hashed and its chain walked
+ * only once.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param key Pointer to the key to be searched for.
+ * @param hash Set to the hash of the key, see `lru_cache_hash()`.
+ * @return The index of the entry, or `LRU_CACHE_ENTRY_NIL` if the key is not cached.
+ */
+uint32_t lru_cache_get_hashed(
+    struct lru_cache *s,
+    const void *key,
+    uint32_t *hash);
+
+/**
+ * @brief Inserts a key that is not cached, like `lru_cache_put()`, with a known hash.
+ *
+ * The hash must come from `lru_cache_get_hashed()` or `lru_cache_hash()` with no lookup in between,
+ * since a lookup may reseed the built-in hash.
+ *
+ * @param s Pointer to the lru_cache structure, with at least one entry.
+ * @param key Pointer to the key to be inserted.
+ * @param hash Hash of the key.
+ * @return The index of the new entry.
+ */
+uint32_t lru_cache_put_hashed(
+    struct lru_cache *s,
+    const void *key,
+    uint32_t hash);
+
+/**
+ * @brief Returns the hash of a key as used by the cache: `hash`, or the built-in keyed hash under
+ *        its current key.
+ */
+uint32_t lru_cache_hash(
+    const struct lru_cache *s,
+    const void *key);
+
+/**
+ * @brief Fills an empty cache with distinct keys in one pass.
+ *
+ * Equivalent to inserting the keys with `lru_cache_get_or_put()` in the given order, so the last key
+ * becomes the most recently used one, but entries are written sequentially and the hashmap is built
+ * in a separate sweep over the precomputed buckets. If `n` exceeds `nmemb`, only the last `nmemb`
+ * keys are loaded. Neither `destroy` nor the trace hook are called for them.
+ *
+ * Pending evictions and stale entries of `lru_cache_flush_lazy()` are drained first. Entries that
+ * were being loaded or pinned during the flush keep their slots, the keys go to the others.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param keys Array of `n` keys of `size` bytes each, from least to most recently used.
+ * @param n Number of keys.
+ * @param hashes Optional hashes of the keys as returned by `hash`, or NULL to compute them. Must be
+ *               NULL for the built-in keyed hash.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: `hashes` was given without a hash function.
+ *         - EBUSY: The cache contains entries, including ones being loaded or pinned.
+ */
+int lru_cache_bulk_load(
+    struct lru_cache *s,
+    const void *keys,
+    uint32_t n,
+    const uint32_t *hashes);
+
+/**
+ * @brief Looks up a key without modifying the cache.
+ *
+ * Unlike `lru_cache_get_or_put()`, the entry is not made the most recently used one and the trace
+ * hook is not called, so this function may run concurrently with a single writer. Such readers must
+ * bracket the lookup and every access to data of the returned entry with `lru_cache_read_begin()` and
+ * `lru_cache_read_retry()`, and discard everything read if a retry is required:
+ *
+ *     do {
+ *         seq = lru_cache_read_begin(s);
+ *         i = lru_cache_find(s, key);
+ *         // copy data of entry i
+ *     } while (lru_cache_read_retry(s, seq));
+ *
+ * Entries being loaded are not found.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param key Pointer to the key to be searched for.
+ * @return The index of the entry, or `LRU_CACHE_ENTRY_NIL` if the key is not cached.
+ */
+uint32_t lru_cache_find(
+    struct lru_cache *s,
+    const void *key);
+
+/**
+ * @brief Makes an entry the most recently used one without a lookup.
+ *
+ * Replays a hit found earlier, e.g. by `lru_cache_find()`. The entry is only moved in the global
+ * chain. Free entries, entries being loaded or evicted, and indices beyond `nmemb` are ignored, as
+ * are all entries while stale entries of `lru_cache_flush_lazy()` remain.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param i Index of the entry.
+ */
+void lru_cache_touch(
+    struct lru_cache *s,
+    uint32_t i);
+
+/**
+ * @brief Makes an entry the least recently used one, so the next insertion evicts it.
+ *
+ * Lets a replacement policy other than LRU choose the victim. Only has an effect if the cache is
+ * full; free entries, entries being loaded, pinned or evicted, and indices beyond `nmemb` are ignored.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param i Index of the entry.
+ */
+void lru_cache_demote(
+    struct lru_cache *s,
+    uint32_t i);
+
+/**
+ * @brief Starts a read section for `lru_cache_find()`, waiting while the writer modifies the cache.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @return The sequence count to pass to `lru_cache_read_retry()`.
+ */
+uint32_t lru_cache_read_begin(
+    const struct lru_cache *s);
+
+/**
+ * @brief Ends a read section.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param seq Sequence count returned by `lru_cache_read_begin()`.
+ * @return `true` if the writer modified the cache during the section, so it must be repeated.
+ */
+bool lru_cache_read_retry(
+    const struct lru_cache *s,
+    uint32_t seq);
+
+/**
+ * @brief Starts a modification of the cache while readers may be running.
+ *
+ * Every call that modifies the cache, including lookups through `lru_cache_get_or_put()`, must be
+ * bracketed by `lru_cache_write_begin()` and `lru_cache_write_end()`. There may only be one writer
+ * at a time. Memory replaced by `lru_cache_set_memory()` or `lru_cache_set_hashmap()` must not be
+ * released before all read sections started before the replacement have ended.
+ *
+ * @param s Pointer to the lru_cache structure.
+ */
+void lru_cache_write_begin(
+    struct lru_cache *s);
+
+/**
+ * @brief Ends a modification started with `lru_cache_write_begin()`.
+ *
+ * @param s Pointer to the lru_cache structure.
+ */
+void lru_cache_write_end(
+    struct lru_cache *s);
+
+/**
+ * @brief Looks up a key and reserves an entry for loading it on a miss.
+ *
+ * On a miss, a new entry is inserted for the key and marked as loading. Lookups for the same key
+ * find this entry and report `LRU_CACHE_LOAD_PENDING` instead of inserting it again, so only one
+ * caller loads the key. Entries being loaded are never evicted and are returned by
+ * `lru_cache_get_or_put()` like any other entry.
+ *
+ * With multiple threads sharing a cache under a lock, a caller seeing `LRU_CACHE_LOAD_MISS` loads
+ * the key without holding the lock and then calls `lru_cache_load_end()` with the lock held again.
+ * Callers seeing `LRU_CACHE_LOAD_PENDING` wait (e.g. on a condition variable signalled after
+ * `lru_cache_load_end()`) and call this function again, since the load may have failed.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param key Pointer to the key to be searched for or inserted.
+ * @param state Set to the outcome of the lookup.
+ * @return The index of the entry, or `LRU_CACHE_ENTRY_NIL` if no entry could be reserved because
+ *         all other entries are being loaded.
+ */
+uint32_t lru_cache_load_begin(
+    struct lru_cache *s,
+    const void *key,
+    enum lru_cache_load_state *state);
+
+/**
+ * @brief Completes a load started by `lru_cache_load_begin()`.
+ *
+ * A loaded entry becomes the most recently used entry. If the load failed, the entry is removed
+ * again without calling `destroy`, and the next lookup of the key starts a new load. If the cache
+ * was flushed during the load, the entry is destroyed instead of being published.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param i Index returned by `lru_cache_load_begin()` with `LRU_CACHE_LOAD_MISS`.
+ * @param loaded Whether the data of the entry was loaded successfully.
+ * @return `i` if the entry was published, or `LRU_CACHE_ENTRY_NIL`.
+ */
+uint32_t lru_cache_load_end(
+    struct lru_cache *s,
+    uint32_t i,
+    bool loaded);
+
+/**
+ * @brief Retrieves a cache entry, calling `load` to fill it on a miss.
+ *
+ * Single-threaded combination of `lru_cache_load_begin()` and `lru_cache_load_end()`.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param key Pointer to the key to be searched for or inserted.
+ * @param load Function loading the data of a missing key.
+ * @param put If non-NULL, set to `true` if the key was loaded, or `false` if it was found.
+ * @return The index of the entry, or `LRU_CACHE_ENTRY_NIL` if the load failed or is already in
+ *         progress.
+ */
+uint32_t lru_cache_get_or_load(
+    struct lru_cache *s,
+    const void *key,
+    lru_cache_load_t load,
+    bool *put);
+
+/**
+ * @brief Pins a cached entry, so it is neither evicted nor reused until it is unpinned.
+ *
+ * Pins are counted; each must be released with `lru_cache_unpin()`. A pinned entry is still found by
+ * lookups, but leaves the recency order until its last pin is released, when it becomes the most
+ * recently used entry. Its index remains valid until then, and pointers to its data as long as the
+ * cache memory is not replaced. Resizes and rehashes keep it reachable; only a shrink that would
+ * drop it fails. An entry flushed while pinned is destroyed when its last pin is released.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param i Index of an entry returned by a lookup.
+ * @return 0 on success, or a positive error number:
+ *         - EINVAL: `i` is not a cached entry, e.g. it was evicted or flushed.
+ *         - EBUSY: The entry is being loaded, or pinning it would exceed `pin_limit` percent of the
+ *                  entries or leave no entry to evict.
+ *         - EOVERFLOW: The entry has too many pins.
+ */
+int lru_cache_pin(
+    struct lru_cache *s,
+    uint32_t i);
+
+/**
+ * @brief Releases a pin of `lru_cache_pin()`.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param i Index of a pinned entry.
+ */
+void lru_cache_unpin(
+    struct lru_cache *s,
+    uint32_t i);
+
 /**
  * @brief Flushes the entire cache, destroying all entries.
  *
- * This function iterates through all entries in the cache and calls the destroy
- * function for each entry if it is provided. After clearing the cache, it resets
- * the global LRU and MRU pointers, preparing the cache for future use.
+ * Invalidates all entries with `lru_cache_flush_lazy()`, then releases them with
+ * `lru_cache_drain_flush()` and completes pending evictions with `lru_cache_drain_evictions()`,
+ * so `destroy` has been called for every entry in the recency order, MRU first, when it returns.
+ * Entries being loaded or pinned are only unlinked; they are destroyed by `lru_cache_load_end()`
+ * or the last `lru_cache_unpin()`.
  *
  * @param s Pointer to the lru_cache structure.
  */
 void lru_cache_flush(
     struct lru_cache *s);
 
+/**
+ * @brief Invalidates all entries of the cache without visiting them.
+ *
+ * The hashmap is cleared and every entry currently in use is marked stale, so subsequent lookups
+ * miss. Stale entries keep their slot until they are reused by `lru_cache_put()` or released by
+ * `lru_cache_drain_flush()`; the `destroy` function is called for them at that point, in MRU to LRU
+ * order. Entries inserted after the flush are never treated as stale. Only while entries are being
+ * loaded or pinned, all entries are scanned to unlink those from their collision chains.
+ *
+ * @param s Pointer to the lru_cache structure.
+ */
+void lru_cache_flush_lazy(
+    struct lru_cache *s);
+
+/**
+ * @brief Releases stale entries left behind by `lru_cache_flush_lazy()`.
+ *
+ * Calls the `destroy` function for up to `budget` stale entries, starting with the most recently
+ * used one, and returns their slots to the cache as free entries.
+ *
+ * @param s Pointer to the lru_cache structure.
+ * @param budget Maximum number of entries to release.
+ * @return The number of entries released. Stale entries remain while `s->stale` is not
+ *         `LRU_CACHE_ENTRY_NIL`.
+ */
+uint32_t lru_cache_drain_flush(
+    struct lru_cache *s,
+    uint32_t budget);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // LRU_CACHE_H_
@@ -0,0 +1,337 @@
+#ifndef LRU_CACHE_HPP_
+#define LRU_CACHE_HPP_
+
+#include "lru-cache.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace lru {
+
+namespace detail {
+
+/**
+ * @struct storage
+ * @brief Memory of a cache with `Capacity` entries, laid out at compile time.
+ *
+ * Keys are stored in the entries of the C cache, values in a separate array indexed by the entry
+ * index. `cache` must be the first member: the destroy function of the C cache only receives the
+ * key, and finds the value through the start of the storage.
+ */
+template <class Key, class Value, std::uint32_t Capacity>
+struct storage {
+    static constexpr std::uint32_t key_align = (alignof(Key) > alignof(std::uint32_t)) ? alignof(Key) : alignof(std::uint32_t);
+    static constexpr std::uint32_t key_size = (sizeof(Key) + key_align - 1) & ~(key_align - 1);
+    static constexpr std::size_t stride = sizeof(lru_cache_entry) + key_size;
+
+    static_assert(key_align <= sizeof(lru_cache_entry), "key alignment exceeds the entry header size");
+    static_assert(Capacity > 0 && Capacity < LRU_CACHE_ENTRY_NIL, "invalid capacity");
+
+    alignas(lru_cache_entry) alignas(key_align) unsigned char cache[Capacity * stride];
+    alignas(Value) unsigned char values[Capacity][sizeof(Value)];
+    std::uint32_t hashmap[(lru_cache_calc_nbuckets(Capacity, LRU_CACHE_LOAD_FACTOR_DEFAULT) * LRU_CACHE_BUCKET_SIZE + sizeof(std::uint32_t) - 1) / sizeof(std::uint32_t)];
+};
+
+template <class Key, class Value, class Hash, class Eq, std::uint32_t Capacity, bool Static>
+class cache {
+    using storage_type = storage<Key, Value, Capacity>;
+
+    static_assert(std::is_nothrow_move_constructible_v<Key>, "keys are moved into the cache");
+    static_assert(std::is_nothrow_move_constructible_v<Value>, "values are moved into the cache");
+    static_assert(std::is_nothrow_destructible_v<Key> && std::is_nothrow_destructible_v<Value>, "entries are destroyed on eviction");
+
+    static constexpr bool trivial_key = std::is_trivially_copyable_v<Key> && sizeof(Key) == storage_type::key_size;
+    static constexpr bool trivial_entry = std::is_trivially_destructible_v<Key> && std::is_trivially_destructible_v<Value>;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+
+    cache()
+    {
+        int rv;
+        std::size_t hashmap_bytes, cache_bytes;
+
+        if constexpr (!Static) {
+            storage_ = std::make_unique<storage_type>();
+        }
+
+        rv = lru_cache_init(&s_, storage_type::key_size, hash, compare, trivial_entry ? nullptr : destroy);
+        rv = rv ? rv : lru_cache_set_nmemb(&s_, Capacity, &hashmap_bytes, &cache_bytes);
+
+        if (rv == 0 && (hashmap_bytes > sizeof(storage_type::hashmap) || cache_bytes > sizeof(storage_type::cache))) {
+            rv = EOVERFLOW;
+        }
+
+        rv = rv ? rv : lru_cache_set_memory(&s_, get().hashmap, get().cache);
+        if (rv != 0) {
+            throw std::system_error(rv, std::generic_category(), "lru_cache");
+        }
+    }
+
+    // Entries refer to the storage by address, only the heap variant can be moved
+    cache(const cache &) = delete;
+    cache &operator=(const cache &) = delete;
+
+    cache(cache &&other) noexcept
+        : storage_(std::move(other.storage_)), s_(other.s_)
+    {
+        static_assert(!Static, "static_cache cannot be moved");
+    }
+
+    cache &operator=(cache &&other) noexcept
+    {
+        static_assert(!Static, "static_cache cannot be moved");
+
+        if (this != &other) {
+            clear();
+            storage_ = std::move(other.storage_);
+            s_ = other.s_;
+        }
+
+        return *this;
+    }
+
+    ~cache()
+    {
+        clear();
+    }
+
+    static constexpr std::uint32_t capacity() noexcept
+    {
+        return Capacity;
+    }
+
+    bool full() noexcept
+    {
+        return lru_cache_is_full(&s_);
+    }
+
+    /**
+     * @brief Looks up a key and makes it the most recently used entry.
+     *
+     * @return Pointer to the value, or nullptr if the key is not cached.
+     */
+    Value *find(const Key &key) noexcept
+    {
+        std::uint32_t i = lookup(key, hash_of(key));
+        return (i != LRU_CACHE_ENTRY_NIL) ? value(i) : nullptr;
+    }
+
+    /**
+     * @brief Moves a key and value into the cache unless the key is cached already.
+     *
+     * Evicts the least recently used entry if the cache is full, destroying its key and value.
+     *
+     * @return Pointer to the cached value, and whether the key was inserted.
+     */
+    std::pair<Value *, bool> insert(Key key, Value v) noexcept
+    {
+        std::pair<std::uint32_t, bool> r = put(std::move(key));
+
+        if (r.second) {
+            ::new (static_cast<void *>(get().values[r.first])) Value(std::move(v));
+        }
+
+        return { value(r.first), r.second };
+    }
+
+    /**
+     * @brief Moves a key and value into the cache, replacing the value if the key is cached.
+     *
+     * @return Pointer to the cached value, and whether the key was inserted.
+     */
+    std::pair<Value *, bool> insert_or_assign(Key key, Value v) noexcept(std::is_nothrow_move_assignable_v<Value>)
+    {
+        std::pair<std::uint32_t, bool> r = put(std::move(key));
+
+        if (r.second) {
+            ::new (static_cast<void *>(get().values[r.first])) Value(std::move(v));
+        } else {
+            *value(r.first) = std::move(v);
+        }
+
+        return { value(r.first), r.second };
+    }
+
+    /**
+     * @brief Calls `f(const Key &, Value &)` for all entries from the most to the least recently used.
+     */
+    template <class F>
+    void for_each(F &&f)
+    {
+        std::uint32_t i;
+        lru_cache_entry *e;
+
+        if (!storage_ready()) {
+            return;
+        }
+
+        LRU_CACHE_ITERATE_MRU_TO_LRU(&s_, i, e) {
+            f(*key(e), *value(i));
+        }
+    }
+
+    /**
+     * @brief Destroys all entries.
+     */
+    void clear() noexcept
+    {
+        if (storage_ready()) {
+            lru_cache_flush(&s_);
+        }
+    }
+
+private:
+    storage_type &get() noexcept
+    {
+        if constexpr (Static) {
+            return storage_;
+        } else {
+            return *storage_;
+        }
+    }
+
+    bool storage_ready() const noexcept
+    {
+        if constexpr (Static) {
+            return true;
+        } else {
+            return storage_ != nullptr;
+        }
+    }
+
+    static Key *key(void *a) noexcept
+    {
+        return std::launder(static_cast<Key *>(a));
+    }
+
+    static Key *key(lru_cache_entry *e) noexcept
+    {
+        return key(static_cast<void *>(e->key));
+    }
+
+    lru_cache_entry *entry(std::uint32_t i) noexcept
+    {
+        return reinterpret_cast<lru_cache_entry *>(get().cache + i * storage_type::stride);
+    }
+
+    Value *value(std::uint32_t i) noexcept
+    {
+        return std::launder(reinterpret_cast<Value *>(get().values[i]));
+    }
+
+    static std::uint32_t hash_of(const Key &k) noexcept
+    {
+        std::uint64_t h = Hash{}(k);
+        return static_cast<std::uint32_t>(h ^ (h >> 32));
+    }
+
+    // The core only calls hash and compare to rehash, and hash to unlink the victim of an eviction
+    static std::uint32_t hash(const void *a) noexcept
+    {
+        return hash_of(*static_cast<const Key *>(a));
+    }
+
+    static int compare(const void *a, const void *b) noexcept
+    {
+        return Eq{}(*static_cast<const Key *>(a), *static_cast<const Key *>(b)) ? 0 : 1;
+    }
+
+    static void destroy(void *a, std::uint32_t i) noexcept
+    {
+        unsigned char *cache = static_cast<unsigned char *>(a) - sizeof(lru_cache_entry) - i * storage_type::stride;
+        storage_type *st = reinterpret_cast<storage_type *>(cache);
+
+        key(a)->~Key();
+        std::launder(reinterpret_cast<Value *>(st->values[i]))->~Value();
+    }
+
+    /**
+     * Same walk as `lru_cache_get_or_put()`, with `Eq` inlined. A hit is moved to the front of both
+     * chains by the core, a miss does not call it at all.
+     */
+    std::uint32_t lookup(const Key &k, std::uint32_t h) noexcept
+    {
+        std::uint32_t b = h & (s_.nbuckets - 1);
+        std::uint32_t i = (lru_cache_get_tags(s_.hashmap, s_.nbuckets)[b] & lru_cache_tag(h)) ? s_.hashmap[b] : LRU_CACHE_ENTRY_NIL;
+        lru_cache_entry *e;
+
+        for (; i != LRU_CACHE_ENTRY_NIL; i = e->clru) {
+            e = entry(i);
+
+            if (Eq{}(*key(e), k)) {
+                return (s_.mru == i) ? i : lru_cache_update_entry(&s_, i, e, b, b);
+            }
+        }
+
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    /**
+     * The C cache copies `key_size` bytes of the key into a new entry. Keys that cannot be copied
+     * that way are moved into a probe of that size first, and moved from the probe into the entry.
+     */
+    std::pair<std::uint32_t, bool> put(Key &&k) noexcept
+    {
+        std::uint32_t h = hash_of(k);
+        std::uint32_t i = lookup(k, h);
+
+        if (i != LRU_CACHE_ENTRY_NIL) {
+            return { i, false };
+        }
+
+        if constexpr (trivial_key) {
+            i = lru_cache_put_hashed(&s_, &k, h);
+        } else {
+            union probe {
+                Key key;
+                unsigned char bytes[storage_type::key_size];
+
+                probe(Key &&from) noexcept : key(std::move(from)) {}
+                ~probe() { key.~Key(); }
+            } p(std::move(k));
+
+            i = lru_cache_put_hashed(&s_, &p.key, h);
+            ::new (static_cast<void *>(entry(i)->key)) Key(std::move(p.key));
+        }
+
+        return { i, true };
+    }
+
+    std::conditional_t<Static, storage_type, std::unique_ptr<storage_type>> storage_;
+    lru_cache s_;
+};
+
+} // namespace detail
+
+/**
+ * @brief LRU cache of at most `Capacity` entries, allocated once on the heap.
+ *
+ * `Hash` and `Eq` are default constructed for every call, like `std::hash` and `std::equal_to`.
+ * Keys and values must be nothrow move constructible; they are destroyed when evicted.
+ *
+ * Lookups hash the key and walk its bucket chain in this header, with `Hash` and `Eq` inlined into
+ * the instantiation, and call into the C core only to reorder a hit or insert a miss. The core calls
+ * `Hash` through a function pointer only for the victim of an eviction.
+ */
+template <class Key, class Value, class Hash, class Eq, std::uint32_t Capacity>
+using cache = detail::cache<Key, Value, Hash, Eq, Capacity, false>;
+
+/**
+ * @brief LRU cache of at most `Capacity` entries stored inside the object, without heap memory.
+ *
+ * Cannot be copied or moved.
+ */
+template <class Key, class Value, class Hash, class Eq, std::uint32_t Capacity>
+using static_cache = detail::cache<Key, Value, Hash, Eq, Capacity, true>;
+
+} // namespace lru
+
+#endif // LRU_CACHE_HPP_
@@ -0,0 +1,120 @@
+#include "lru-cache-access.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+
+#define CACHE_LINE_SIZE 64
+
+/*
+ * Each stripe is a ring buffer with many producers and a single consumer. Producers claim a slot by
+ * advancing the tail, then publish the entry index plus one in it; the consumer stops at slots that
+ * are claimed but not yet published and clears the slots it consumes.
+ */
+struct stripe {
+    uint32_t tail; ///< Next slot to be claimed by a reader.
+    uint32_t head; ///< Next slot to be consumed by the writer.
+    uint32_t slots[]; ///< Entry index plus one, or 0 if not published.
+};
+
+// Stripe of the calling thread in the buffers it recorded into last
+static _Thread_local const struct lru_cache_access *thread_buffers;
+static _Thread_local uint32_t thread_stripe;
+
+static struct stripe *get_stripe(struct lru_cache_access *a, uint32_t n)
+{
+    return (struct stripe *)((char *)a->stripes + n * a->stride);
+}
+
+int lru_cache_access_init(struct lru_cache_access *a, struct lru_cache *s, uint32_t nstripes, uint32_t nmemb)
+{
+    size_t stride = sizeof(struct stripe) + (size_t)nmemb * sizeof(uint32_t);
+
+    if (nstripes == 0 || nmemb == 0 || (nmemb & (nmemb - 1)) != 0) {
+        return EINVAL;
+    }
+
+    // Stripes of different threads never share a cache line
+    stride = (stride + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+
+    if ((a->stripes = aligned_alloc(CACHE_LINE_SIZE, stride * nstripes)) == NULL) {
+        return ENOMEM;
+    }
+
+    memset(a->stripes, 0, stride * nstripes);
+
+    a->s = s;
+    a->stride = stride;
+    a->nstripes = nstripes;
+    a->mask = nmemb - 1;
+    a->next_stripe = 0;
+    return 0;
+}
+
+void lru_cache_access_free(struct lru_cache_access *a)
+{
+    free(a->stripes);
+    a->stripes = NULL;
+}
+
+bool lru_cache_access_record(struct lru_cache_access *a, uint32_t i)
+{
+    struct stripe *b;
+    uint32_t tail;
+
+    // Slots hold the index plus one, so LRU_CACHE_ENTRY_NIL would never read as published
+    if (i == LRU_CACHE_ENTRY_NIL || i >= a->s->nmemb) {
+        return false;
+    }
+
+    if (thread_buffers != a) {
+        thread_buffers = a;
+        thread_stripe = __atomic_fetch_add(&a->next_stripe, 1, __ATOMIC_RELAXED);
+    }
+
+    b = get_stripe(a, thread_stripe % a->nstripes);
+    tail = __atomic_load_n(&b->tail, __ATOMIC_RELAXED);
+
+    // Full, or another reader of the stripe was faster: drop rather than wait
+    if (tail - __atomic_load_n(&b->head, __ATOMIC_ACQUIRE) > a->mask) {
+        return false;
+    }
+
+    if (!__atomic_compare_exchange_n(&b->tail, &tail, tail + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    __atomic_store_n(&b->slots[tail & a->mask], i + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint32_t lru_cache_access_drain(struct lru_cache_access *a, uint32_t budget)
+{
+    uint32_t n = 0;
+    uint32_t k;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t i;
+    struct stripe *b;
+
+    for (k = 0; k < a->nstripes && n < budget; k++) {
+        b = get_stripe(a, k);
+        head = b->head;
+        tail = __atomic_load_n(&b->tail, __ATOMIC_RELAXED);
+
+        for (; head != tail && n < budget; head++, n++) {
+            if ((i = __atomic_load_n(&b->slots[head & a->mask], __ATOMIC_ACQUIRE)) == 0) {
+                break;
+            }
+
+            b->slots[head & a->mask] = 0;
+            lru_cache_touch(a->s, i - 1);
+        }
+
+        // Slots become available to readers again
+        __atomic_store_n(&b->head, head, __ATOMIC_RELEASE);
+    }
+
+    return n;
+}
@@ -0,0 +1,258 @@
+#include "lru-cache-autosize.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+
+static int read_psi(const char *path, double *avg10)
+{
+    int rv = 0;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        return errno;
+    }
+
+    if (fscanf(f, "some avg10=%lf", avg10) != 1) {
+        rv = EINVAL;
+    }
+
+    fclose(f);
+    return rv;
+}
+
+static int read_cgroup(const char *dir, const char *name, uint64_t *value)
+{
+    int rv = 0;
+    char path[4096];
+    char line[64];
+    char *end;
+    FILE *f;
+
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", dir, name) >= sizeof(path)) {
+        return ENAMETOOLONG;
+    }
+
+    if ((f = fopen(path, "r")) == NULL) {
+        return errno;
+    }
+
+    if (fgets(line, sizeof(line), f) == NULL) {
+        rv = EINVAL;
+    } else if (strncmp(line, "max", 3) == 0) {
+        *value = UINT64_MAX;
+    } else if ((*value = strtoull(line, &end, 10)), end == line) {
+        rv = EINVAL;
+    }
+
+    fclose(f);
+    return rv;
+}
+
+static void *alloc_cache(const struct lru_cache *s, size_t bytes)
+{
+    // malloc only aligns for max_align_t, larger key alignments need aligned_alloc and its size rule
+    if (s->align <= _Alignof(max_align_t)) {
+        return malloc(bytes);
+    }
+
+    return aligned_alloc(s->align, (bytes + s->align - 1) & ~((size_t)s->align - 1));
+}
+
+static int resize(struct lru_cache_autosize *a, uint32_t nmemb)
+{
+    int rv;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    uint32_t old_nmemb = a->s->nmemb;
+
+    rv = lru_cache_set_nmemb(a->s, nmemb, &hashmap_bytes, &cache_bytes);
+    if (rv != 0) {
+        return rv;
+    }
+
+    // When shrinking, entries are already removed; a failed realloc keeps the larger block
+    if ((hashmap = realloc(a->hashmap, hashmap_bytes)) != NULL) {
+        a->hashmap = hashmap;
+    }
+
+    if (a->s->align <= _Alignof(max_align_t)) {
+        if ((cache = realloc(a->cache, cache_bytes)) != NULL) {
+            a->cache = cache;
+            a->cache_bytes = cache_bytes;
+        }
+    } else if ((cache = alloc_cache(a->s, cache_bytes)) != NULL) {
+        // Aligned blocks cannot be reallocated, the old one is released once the cache uses the copy
+        memcpy(cache, a->cache, (a->cache_bytes < cache_bytes) ? a->cache_bytes : cache_bytes);
+    }
+
+    if (nmemb > old_nmemb && (hashmap == NULL || cache == NULL)) {
+        if (cache != a->cache) {
+            free(cache);
+        }
+
+        lru_cache_set_nmemb(a->s, old_nmemb, NULL, NULL);
+        lru_cache_set_memory(a->s, a->hashmap, a->cache);
+        return ENOMEM;
+    }
+
+    if (cache == NULL || cache == a->cache) {
+        return lru_cache_set_memory(a->s, a->hashmap, a->cache);
+    }
+
+    if ((rv = lru_cache_set_memory(a->s, a->hashmap, cache)) != 0) {
+        free(cache);
+        return rv;
+    }
+
+    free(a->cache);
+    a->cache = cache;
+    a->cache_bytes = cache_bytes;
+    return 0;
+}
+
+int lru_cache_autosize_init(struct lru_cache_autosize *a, struct lru_cache *s, uint32_t nmemb)
+{
+    int rv;
+    uint64_t max_nmemb = (uint64_t)nmemb * 16;
+    size_t hashmap_bytes, cache_bytes;
+
+    a->s = s;
+
+    a->min_nmemb = nmemb;
+    a->max_nmemb = (max_nmemb < UINT32_MAX) ? max_nmemb : UINT32_MAX - 1;
+    a->step = (nmemb >= 8) ? nmemb / 8 : 1;
+    a->min_gain = 0.01;
+
+    a->psi_path = LRU_CACHE_AUTOSIZE_PSI_PATH;
+    a->psi_high = 10.0;
+    a->psi_low = 2.0;
+
+    a->cgroup_path = NULL;
+    a->usage_high = 0.9;
+    a->usage_low = 0.8;
+
+    a->pressure = false;
+    a->growing = false;
+    a->ratio = -1.0;
+
+    a->hits = 0;
+    a->lookups = 0;
+
+    rv = lru_cache_set_nmemb(s, nmemb, &hashmap_bytes, &cache_bytes);
+    if (rv != 0) {
+        return rv;
+    }
+
+    a->hashmap = malloc(hashmap_bytes);
+    a->cache = alloc_cache(s, cache_bytes);
+    a->cache_bytes = cache_bytes;
+
+    if (a->hashmap == NULL || a->cache == NULL) {
+        lru_cache_autosize_free(a);
+        return ENOMEM;
+    }
+
+    rv = lru_cache_set_memory(s, a->hashmap, a->cache);
+    if (rv != 0) {
+        lru_cache_autosize_free(a);
+        return rv;
+    }
+
+    a->next_trace = s->trace;
+    a->next_trace_arg = s->trace_arg;
+
+    s->trace = lru_cache_autosize_access;
+    s->trace_arg = a;
+    return 0;
+}
+
+void lru_cache_autosize_free(struct lru_cache_autosize *a)
+{
+    free(a->hashmap);
+    free(a->cache);
+
+    a->hashmap = NULL;
+    a->cache = NULL;
+}
+
+void lru_cache_autosize_access(void *a_, const void *key, uint32_t hash, bool hit)
+{
+    struct lru_cache_autosize *a = a_;
+
+    a->hits += hit;
+    a->lookups++;
+
+    if (a->next_trace) {
+        a->next_trace(a->next_trace_arg, key, hash, hit);
+    }
+}
+
+int lru_cache_autosize_step(struct lru_cache_autosize *a)
+{
+    double psi = 0.0;
+    double usage = 0.0;
+    double ratio = -1.0;
+    uint64_t current, max;
+    uint32_t nmemb = a->s->nmemb;
+
+    // Without the hook, the hit ratio would be that of no lookups
+    if (a->s->trace != lru_cache_autosize_access || a->s->trace_arg != a) {
+        return EBUSY;
+    }
+
+    // Unavailable sources do not count as pressure
+    if (a->psi_path && read_psi(a->psi_path, &psi) != 0) {
+        psi = 0.0;
+    }
+
+    if (a->cgroup_path &&
+        read_cgroup(a->cgroup_path, "memory.current", &current) == 0 &&
+        read_cgroup(a->cgroup_path, "memory.max", &max) == 0 &&
+        max != UINT64_MAX && max != 0) {
+        usage = (double)current / max;
+    }
+
+    if (psi >= a->psi_high || usage >= a->usage_high) {
+        a->pressure = true;
+    } else if (psi < a->psi_low && usage < a->usage_low) {
+        a->pressure = false;
+    }
+
+    if (a->lookups > 0) {
+        ratio = (double)a->hits / a->lookups;
+    }
+
+    a->hits = 0;
+    a->lookups = 0;
+
+    if (a->pressure) {
+        a->growing = false;
+        nmemb = (nmemb > a->min_nmemb && nmemb - a->min_nmemb > a->step) ? nmemb - a->step : a->min_nmemb;
+    } else if (ratio >= 0.0) {
+        if (a->growing) {
+            // Keep growing only while it pays off
+            a->growing = (ratio - a->ratio >= a->min_gain);
+        } else {
+            // Start growing initially, or when the workload got worse
+            a->growing = lru_cache_is_full(a->s) && (a->ratio < 0.0 || ratio <= a->ratio - a->min_gain);
+        }
+
+        if (a->growing) {
+            nmemb = (nmemb < a->max_nmemb && a->max_nmemb - nmemb > a->step) ? nmemb + a->step : a->max_nmemb;
+        }
+    }
+
+    if (ratio >= 0.0) {
+        a->ratio = ratio;
+    }
+
+    if (nmemb == a->s->nmemb) {
+        return 0;
+    }
+
+    return resize(a, nmemb);
+}
@@ -0,0 +1,208 @@
+#include "lru-cache-lru2.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <assert.h>
+#include <errno.h>
+
+static bool less(const struct lru_cache_lru2 *k, uint32_t a, uint32_t b)
+{
+    return k->prev[a] < k->prev[b] || (k->prev[a] == k->prev[b] && k->last[a] < k->last[b]);
+}
+
+static void place(struct lru_cache_lru2 *k, uint32_t p, uint32_t i)
+{
+    k->heap[p] = i;
+    k->pos[i] = p;
+}
+
+static void sift_up(struct lru_cache_lru2 *k, uint32_t p)
+{
+    uint32_t i = k->heap[p];
+
+    for (; p > 0 && less(k, i, k->heap[(p - 1) / 2]); p = (p - 1) / 2) {
+        place(k, p, k->heap[(p - 1) / 2]);
+    }
+
+    place(k, p, i);
+}
+
+static void sift_down(struct lru_cache_lru2 *k, uint32_t p)
+{
+    uint32_t i = k->heap[p];
+    uint32_t child;
+
+    for (; (child = 2 * p + 1) < k->count; p = child) {
+        if (child + 1 < k->count && less(k, k->heap[child + 1], k->heap[child])) {
+            child++;
+        }
+
+        if (!less(k, k->heap[child], i)) {
+            break;
+        }
+
+        place(k, p, k->heap[child]);
+    }
+
+    place(k, p, i);
+}
+
+static void update(struct lru_cache_lru2 *k, uint32_t i)
+{
+    if (k->pos[i] == LRU_CACHE_ENTRY_NIL) {
+        place(k, k->count++, i);
+    }
+
+    sift_up(k, k->pos[i]);
+    sift_down(k, k->pos[i]);
+}
+
+static bool is_detached(const struct lru_cache_lru2 *k, uint32_t i)
+{
+    // Pinned entries link to themselves outside the global chain, see lru_cache_pin
+    return lru_cache_get_entry(k->s, i)->mru == i;
+}
+
+static void demote_victim(struct lru_cache_lru2 *k)
+{
+    /*
+     * Pinned entries cannot be evicted, so pinned heap tops are moved just past the end of the heap
+     * until an evictable top is found, and put back afterwards.
+     */
+    uint32_t n = k->count;
+    uint32_t i;
+
+    while (k->count > 0 && is_detached(k, k->heap[0])) {
+        i = k->heap[0];
+        place(k, 0, k->heap[--k->count]);
+        sift_down(k, 0);
+        place(k, k->count, i);
+    }
+
+    if (k->count > 0) {
+        lru_cache_demote(k->s, k->heap[0]);
+    }
+
+    while (k->count < n) {
+        sift_up(k, k->count++);
+    }
+}
+
+static void remember(struct lru_cache_lru2 *k, uint32_t i)
+{
+    struct lru_cache_entry *e = lru_cache_get_entry(k->s, i);
+    uint32_t hash = lru_cache_hash(k->s, e->key);
+    struct lru_cache_lru2_history *h = &k->history[hash & k->history_mask];
+
+    h->fingerprint = hash;
+    h->last = k->last[i];
+}
+
+int lru_cache_lru2_init(struct lru_cache_lru2 *k, struct lru_cache *s, uint32_t history_nmemb)
+{
+    uint32_t i;
+    uint64_t n;
+    struct lru_cache_entry *e;
+
+    if (s->nmemb == 0 || history_nmemb == 0 || (history_nmemb & (history_nmemb - 1)) != 0) {
+        return EINVAL;
+    }
+
+    k->s = s;
+    k->nmemb = s->nmemb;
+    k->now = 0;
+
+    k->last = calloc(s->nmemb, sizeof(*k->last));
+    k->prev = calloc(s->nmemb, sizeof(*k->prev));
+
+    k->heap = malloc(s->nmemb * sizeof(*k->heap));
+    k->pos = malloc(s->nmemb * sizeof(*k->pos));
+    k->count = 0;
+
+    k->history = calloc(history_nmemb, sizeof(*k->history));
+    k->history_mask = history_nmemb - 1;
+    k->history_hits = 0;
+
+    if (!k->last || !k->prev || !k->heap || !k->pos || !k->history) {
+        lru_cache_lru2_free(k);
+        return ENOMEM;
+    }
+
+    memset(k->pos, 0xff, s->nmemb * sizeof(*k->pos));
+
+    // Entries cached before are ranked as if they were accessed once, from LRU to MRU
+    LRU_CACHE_ITERATE_MRU_TO_LRU(s, i, e) {
+        k->now++;
+    }
+
+    n = k->now;
+    LRU_CACHE_ITERATE_MRU_TO_LRU(s, i, e) {
+        k->last[i] = n--;
+        update(k, i);
+    }
+
+    return 0;
+}
+
+void lru_cache_lru2_free(struct lru_cache_lru2 *k)
+{
+    free(k->last);
+    free(k->prev);
+    free(k->heap);
+    free(k->pos);
+    free(k->history);
+
+    k->last = NULL;
+    k->prev = NULL;
+    k->heap = NULL;
+    k->pos = NULL;
+    k->history = NULL;
+}
+
+uint32_t lru_cache_lru2_get_or_put(struct lru_cache_lru2 *k, const void *key, bool *put)
+{
+    struct lru_cache *s = k->s;
+    uint32_t hash;
+    uint32_t i = lru_cache_get_hashed(s, key, &hash);
+    struct lru_cache_lru2_history *h;
+
+    assert(s->nmemb == k->nmemb);
+
+    if (put) {
+        *put = false;
+    }
+
+    if (i != LRU_CACHE_ENTRY_NIL) {
+        k->prev[i] = (k->pos[i] != LRU_CACHE_ENTRY_NIL) ? k->last[i] : 0;
+        k->last[i] = ++k->now;
+        update(k, i);
+        return i;
+    }
+
+    if (put == NULL) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    if (lru_cache_is_full(s)) {
+        demote_victim(k);
+        remember(k, s->lru);
+    }
+
+    i = lru_cache_put_hashed(s, key, hash);
+    *put = true;
+
+    h = &k->history[hash & k->history_mask];
+
+    if (h->last != 0 && h->fingerprint == hash) {
+        k->prev[i] = h->last;
+        k->history_hits++;
+        h->last = 0;
+    } else {
+        k->prev[i] = 0;
+    }
+
+    k->last[i] = ++k->now;
+    update(k, i);
+    return i;
+}
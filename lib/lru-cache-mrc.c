@@ -0,0 +1,237 @@
+#include "lru-cache-mrc.h"
+#include "lru-cache.h"
+
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+
+static void tree_add(struct lru_cache_mrc *m, uint32_t t, uint32_t v)
+{
+    for (t++; t <= m->window; t += t & -t) {
+        m->tree[t] += v;
+    }
+}
+
+// Number of tracked keys whose last access was before time t
+static uint32_t tree_sum(const struct lru_cache_mrc *m, uint32_t t)
+{
+    uint32_t sum = 0;
+
+    for (; t > 0; t -= t & -t) {
+        sum += m->tree[t];
+    }
+
+    return sum;
+}
+
+static uint32_t find_slot(const struct lru_cache_mrc *m, uint64_t hash)
+{
+    uint32_t slot = hash & m->mask;
+
+    while (m->times[slot] != LRU_CACHE_ENTRY_NIL && m->hashes[slot] != hash) {
+        slot = (slot + 1) & m->mask;
+    }
+
+    return slot;
+}
+
+static void remove_slot(struct lru_cache_mrc *m, uint32_t slot)
+{
+    uint32_t next = slot;
+    uint32_t home;
+
+    // Backward shift deletion, so lookups never need tombstones
+    for (;;) {
+        next = (next + 1) & m->mask;
+
+        if (m->times[next] == LRU_CACHE_ENTRY_NIL) {
+            break;
+        }
+
+        home = m->hashes[next] & m->mask;
+
+        if (((next - home) & m->mask) < ((next - slot) & m->mask)) {
+            continue;
+        }
+
+        m->hashes[slot] = m->hashes[next];
+        m->times[slot] = m->times[next];
+        m->owner[m->times[slot]] = slot;
+        slot = next;
+    }
+
+    m->times[slot] = LRU_CACHE_ENTRY_NIL;
+}
+
+static void forget_oldest(struct lru_cache_mrc *m)
+{
+    uint32_t slot;
+
+    while (m->owner[m->oldest] == LRU_CACHE_ENTRY_NIL) {
+        m->oldest++;
+    }
+
+    slot = m->owner[m->oldest];
+
+    tree_add(m, m->oldest, -1);
+    m->owner[m->oldest] = LRU_CACHE_ENTRY_NIL;
+
+    remove_slot(m, slot);
+    m->nkeys--;
+}
+
+static void compact(struct lru_cache_mrc *m)
+{
+    // Renumber last accesses to 0 ... nkeys - 1, keeping their order and therefore all distances
+    uint32_t t;
+    uint32_t n = 0;
+    uint32_t slot;
+
+    memset(m->tree, 0, (m->window + 1) * sizeof(*m->tree));
+
+    for (t = m->oldest; t < m->window; t++) {
+        if ((slot = m->owner[t]) == LRU_CACHE_ENTRY_NIL) {
+            continue;
+        }
+
+        m->owner[t] = LRU_CACHE_ENTRY_NIL;
+        m->owner[n] = slot;
+        m->times[slot] = n;
+
+        tree_add(m, n++, 1);
+    }
+
+    m->now = n;
+    m->oldest = 0;
+}
+
+int lru_cache_mrc_init(struct lru_cache_mrc *m, double rate, uint32_t capacity)
+{
+    uint32_t table = 1;
+
+    if (!(rate > 0.0 && rate <= 1.0) || capacity == 0 || capacity > UINT32_MAX / 4) {
+        return EINVAL;
+    }
+
+    while (table < capacity * 2) {
+        table <<= 1;
+    }
+
+    m->rate = rate;
+    m->threshold = (uint32_t)(rate * (1u << 24));
+
+    m->capacity = capacity;
+    m->nkeys = 0;
+
+    m->window = capacity * 2;
+    m->now = 0;
+    m->oldest = 0;
+
+    m->mask = table - 1;
+    m->hashes = malloc(table * sizeof(*m->hashes));
+    m->times = malloc(table * sizeof(*m->times));
+
+    m->owner = malloc(m->window * sizeof(*m->owner));
+    m->tree = calloc(m->window + 1, sizeof(*m->tree));
+
+    m->histogram = calloc(capacity, sizeof(*m->histogram));
+    m->cold = 0;
+    m->samples = 0;
+
+    if (!m->hashes || !m->times || !m->owner || !m->tree || !m->histogram) {
+        lru_cache_mrc_free(m);
+        return ENOMEM;
+    }
+
+    memset(m->times, 0xff, table * sizeof(*m->times));
+    memset(m->owner, 0xff, m->window * sizeof(*m->owner));
+    return 0;
+}
+
+void lru_cache_mrc_free(struct lru_cache_mrc *m)
+{
+    free(m->hashes);
+    free(m->times);
+    free(m->owner);
+    free(m->tree);
+    free(m->histogram);
+
+    m->hashes = NULL;
+    m->times = NULL;
+    m->owner = NULL;
+    m->tree = NULL;
+    m->histogram = NULL;
+}
+
+void lru_cache_mrc_access_hash(struct lru_cache_mrc *m, uint64_t hash)
+{
+    uint32_t slot;
+    uint32_t prev;
+
+    if ((uint32_t)(hash >> 40) >= m->threshold) {
+        return;
+    }
+
+    m->samples++;
+
+    if (m->now == m->window) {
+        compact(m);
+    }
+
+    slot = find_slot(m, hash);
+
+    if (m->times[slot] != LRU_CACHE_ENTRY_NIL) {
+        prev = m->times[slot];
+
+        m->histogram[tree_sum(m, m->now) - tree_sum(m, prev + 1)]++;
+
+        tree_add(m, prev, -1);
+        m->owner[prev] = LRU_CACHE_ENTRY_NIL;
+    } else {
+        m->cold++;
+
+        if (m->nkeys == m->capacity) {
+            forget_oldest(m);
+            slot = find_slot(m, hash);
+        }
+
+        m->hashes[slot] = hash;
+        m->nkeys++;
+    }
+
+    m->times[slot] = m->now;
+    m->owner[m->now] = slot;
+
+    tree_add(m, m->now++, 1);
+}
+
+void lru_cache_mrc_access(void *m, const void *key, uint32_t hash, bool hit)
+{
+    // The hash of the cache only spreads keys over buckets, its upper bits may be poorly mixed
+    uint64_t h = hash;
+
+    (void)key;
+    (void)hit;
+
+    h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdull;
+    h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ull;
+
+    lru_cache_mrc_access_hash(m, h ^ (h >> 33));
+}
+
+double lru_cache_mrc_hit_ratio(const struct lru_cache_mrc *m, uint64_t nmemb)
+{
+    uint64_t d;
+    uint64_t hits = 0;
+    double limit = nmemb * m->rate;
+
+    if (m->samples == 0) {
+        return 0.0;
+    }
+
+    for (d = 0; d < m->capacity && d < limit; d++) {
+        hits += m->histogram[d];
+    }
+
+    return (double)hits / m->samples;
+}
@@ -0,0 +1,137 @@
+#include "lru-cache-tier.h"
+
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+
+int lru_cache_tier_init(
+    struct lru_cache_tier *t,
+    struct lru_cache *hot,
+    struct lru_cache *cold,
+    uint32_t *evictions,
+    uint32_t nmemb)
+{
+    if (hot->size != cold->size || evictions == NULL || nmemb == 0) {
+        return EINVAL;
+    }
+
+    t->hot = hot;
+    t->cold = cold;
+    t->demotions = 0;
+    t->promotions = 0;
+
+    return lru_cache_set_evictions(hot, evictions, nmemb);
+}
+
+uint32_t lru_cache_tier_writeback(struct lru_cache_tier *t, uint32_t budget)
+{
+    bool put;
+    uint32_t n;
+    struct lru_cache *hot = t->hot;
+    struct lru_cache_entry *e;
+    struct lru_cache_entry *c;
+
+    for (n = 0; n < budget && hot->evictions_count > 0; n++) {
+        e = lru_cache_get_entry(hot, hot->evictions[hot->evictions_head]);
+        c = lru_cache_get_entry(t->cold, lru_cache_get_or_put(t->cold, e->key, &put));
+
+        // Unchanged records leave the cold page clean
+        if (c && !put && memcmp(c->key, e->key, hot->size) != 0) {
+            memcpy(c->key, e->key, hot->size);
+            put = true;
+        }
+
+        t->demotions += (c && put);
+        lru_cache_drain_evictions(hot, 1);
+    }
+
+    return n;
+}
+
+uint32_t lru_cache_tier_get_or_put(
+    struct lru_cache_tier *t,
+    const void *key,
+    bool *put,
+    enum lru_cache_tier_hit *hit)
+{
+    uint32_t i = lru_cache_get_or_put(t->hot, key, NULL);
+    struct lru_cache_entry *c;
+
+    if (put) {
+        *put = false;
+    }
+
+    if (i != LRU_CACHE_ENTRY_NIL) {
+        *hit = LRU_CACHE_TIER_HOT;
+        return i;
+    }
+
+    /*
+     * A pending eviction may hold a newer version of the record than the cold tier, and lru_cache_put
+     * would otherwise complete the oldest one without demoting it. Demoting before the cold lookup
+     * also keeps the insertions into the cold tier from reusing the slot of the record found there.
+     */
+    if (t->hot->evictions_count > 0) {
+        lru_cache_tier_writeback(t, UINT32_MAX);
+    }
+
+    c = lru_cache_get_entry(t->cold, lru_cache_get_or_put(t->cold, key, NULL));
+    *hit = c ? LRU_CACHE_TIER_COLD : LRU_CACHE_TIER_MISS;
+
+    if (c == NULL && put == NULL) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    if (c) {
+        t->promotions++;
+        return lru_cache_put(t->hot, c->key);
+    }
+
+    *put = true;
+    return lru_cache_put(t->hot, key);
+}
+
+int lru_cache_tier_map(const char *path, size_t bytes, void **addr)
+{
+    int rv = 0;
+    struct stat st;
+    void *p = MAP_FAILED;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (fd < 0) {
+        return errno;
+    }
+
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size < bytes && ftruncate(fd, bytes) != 0)) {
+        rv = errno;
+    } else if ((p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        rv = errno;
+    } else {
+        // Only a hint, failure does not matter
+        posix_madvise(p, bytes, POSIX_MADV_RANDOM);
+        *addr = p;
+    }
+
+    close(fd);
+    return rv;
+}
+
+int lru_cache_tier_unmap(void *addr, size_t bytes)
+{
+    int rv = 0;
+
+    if (msync(addr, bytes, MS_SYNC) != 0) {
+        rv = errno;
+    }
+
+    if (munmap(addr, bytes) != 0 && rv == 0) {
+        rv = errno;
+    }
+
+    return rv;
+}
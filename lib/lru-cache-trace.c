@@ -0,0 +1,115 @@
+#include "lru-cache-trace.h"
+
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <errno.h>
+
+static _Thread_local struct lru_cache_trace_record buffer[LRU_CACHE_TRACE_BUFFER_NMEMB];
+static _Thread_local uint32_t buffer_nmemb;
+
+// Trace the buffered records belong to
+static _Thread_local struct lru_cache_trace *buffer_trace;
+
+static int write_all(int fd, const void *data, size_t size)
+{
+    const char *d = data;
+    ssize_t n;
+
+    while (size > 0) {
+        n = write(fd, d, size);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            return errno;
+        }
+
+        d += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static int write_buffer(void)
+{
+    // O_APPEND keeps blocks of different threads from overwriting each other
+    int rv = write_all(buffer_trace->fd, buffer, buffer_nmemb * sizeof(*buffer));
+
+    buffer_nmemb = 0;
+    return rv;
+}
+
+int lru_cache_trace_open(struct lru_cache_trace *t, const char *path)
+{
+    int rv;
+
+    t->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (t->fd < 0) {
+        return errno;
+    }
+
+    rv = write_all(t->fd, LRU_CACHE_TRACE_MAGIC, sizeof(LRU_CACHE_TRACE_MAGIC) - 1);
+    if (rv != 0) {
+        close(t->fd);
+        t->fd = -1;
+        return rv;
+    }
+
+    return 0;
+}
+
+void lru_cache_trace_record(void *t, const void *key, uint32_t hash, bool hit)
+{
+    struct timespec ts;
+    struct lru_cache_trace_record *r;
+
+    (void)key;
+
+    if (buffer_trace != t || buffer_nmemb == LRU_CACHE_TRACE_BUFFER_NMEMB) {
+        if (buffer_nmemb > 0) {
+            write_buffer();
+        }
+
+        buffer_trace = t;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    r = &buffer[buffer_nmemb++];
+    r->hash = hash;
+    r->stamp = (((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec) << 1) | hit;
+}
+
+int lru_cache_trace_flush(struct lru_cache_trace *t)
+{
+    if (t->fd < 0) {
+        return EBADF;
+    }
+
+    if (buffer_trace != t || buffer_nmemb == 0) {
+        return 0;
+    }
+
+    return write_buffer();
+}
+
+int lru_cache_trace_close(struct lru_cache_trace *t)
+{
+    int rv = lru_cache_trace_flush(t);
+
+    if (rv == EBADF) {
+        return rv;
+    }
+
+    if (close(t->fd) != 0 && rv == 0) {
+        rv = errno;
+    }
+
+    t->fd = -1;
+    return rv;
+}
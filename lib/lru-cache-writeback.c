@@ -0,0 +1,249 @@
+#include "lru-cache-writeback.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <assert.h>
+#include <errno.h>
+
+// Entries examined per batch entry when collecting the dirty entries that follow a victim
+#define SCAN_FACTOR 4
+
+static void clear_dirty(struct lru_cache_writeback *w, uint32_t i)
+{
+    if (lru_cache_writeback_is_dirty(w, i)) {
+        w->dirty[i / 64] &= ~(1ull << (i % 64));
+        w->ndirty--;
+    }
+}
+
+static uint32_t first_live(struct lru_cache *s)
+{
+    // From LRU to MRU, the global chain holds free, then stale, then fresh entries
+    uint32_t i;
+
+    if (s->stale != LRU_CACHE_ENTRY_NIL) {
+        return (s->stale != s->mru) ? lru_cache_get_entry(s, s->stale)->mru : LRU_CACHE_ENTRY_NIL;
+    }
+
+    for (i = s->lru; lru_cache_get_entry(s, i)->clru == i; i = lru_cache_get_entry(s, i)->mru) {
+        if (i == s->mru) {
+            return LRU_CACHE_ENTRY_NIL;
+        }
+    }
+
+    return i;
+}
+
+static int write_batch(struct lru_cache_writeback *w, uint32_t n)
+{
+    uint32_t k;
+    int rv;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    if ((rv = w->write(w->arg, w->s, w->batch, n)) != 0) {
+        w->errors++;
+        return rv;
+    }
+
+    for (k = 0; k < n; k++) {
+        clear_dirty(w, w->batch[k]);
+    }
+
+    w->batches++;
+    w->written += n;
+    return 0;
+}
+
+static int write_from(struct lru_cache_writeback *w, uint32_t i, uint32_t limit, uint32_t max, uint32_t *written)
+{
+    // Writes the dirty entries among `limit` entries from `i` toward the MRU end, at most `max`
+    struct lru_cache *s = w->s;
+    uint32_t n = 0;
+    int rv;
+
+    for (; i != LRU_CACHE_ENTRY_NIL && limit > 0 && *written + n < max; limit--) {
+        if (lru_cache_writeback_is_dirty(w, i)) {
+            w->batch[n++] = i;
+        }
+
+        if (n == w->batch_nmemb) {
+            if ((rv = write_batch(w, n)) != 0) {
+                return rv;
+            }
+
+            *written += n;
+            n = 0;
+        }
+
+        i = (i != s->mru) ? lru_cache_get_entry(s, i)->mru : LRU_CACHE_ENTRY_NIL;
+    }
+
+    if ((rv = write_batch(w, n)) == 0) {
+        *written += n;
+    }
+
+    return rv;
+}
+
+int lru_cache_writeback_init(
+    struct lru_cache_writeback *w,
+    struct lru_cache *s,
+    uint32_t batch_nmemb,
+    lru_cache_write_t write,
+    void *arg)
+{
+    // A pending resize would change nmemb, and deferred evictions skip the write of the victim
+    if (s->nmemb == 0 || s->try_nmemb != s->nmemb || s->evictions_nmemb != 0 || batch_nmemb == 0 ||
+        write == NULL) {
+        return EINVAL;
+    }
+
+    w->s = s;
+    w->nmemb = s->nmemb;
+
+    w->dirty = calloc((s->nmemb + 63) / 64, sizeof(*w->dirty));
+    w->ndirty = 0;
+
+    w->batch = malloc(batch_nmemb * sizeof(*w->batch));
+    w->batch_nmemb = batch_nmemb;
+
+    w->write = write;
+    w->arg = arg;
+
+    w->batches = 0;
+    w->written = 0;
+    w->errors = 0;
+
+    if (!w->dirty || !w->batch) {
+        lru_cache_writeback_free(w);
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+void lru_cache_writeback_free(struct lru_cache_writeback *w)
+{
+    free(w->dirty);
+    free(w->batch);
+
+    w->dirty = NULL;
+    w->batch = NULL;
+}
+
+uint32_t lru_cache_writeback_get_or_put(struct lru_cache_writeback *w, const void *key, bool *put)
+{
+    struct lru_cache *s = w->s;
+    uint32_t hash;
+    uint32_t i = lru_cache_get_hashed(s, key, &hash);
+    uint32_t written = 0;
+
+    if (put) {
+        *put = false;
+    }
+
+    if (i != LRU_CACHE_ENTRY_NIL || put == NULL) {
+        return i;
+    }
+
+    // The dirty bits no longer cover all entries, or the victim would leave without being written
+    if (s->nmemb != w->nmemb || s->evictions_nmemb != 0) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    // Full without invalidated entries, so the LRU entry is the victim
+    if (lru_cache_is_full(s) && lru_cache_writeback_is_dirty(w, s->lru) &&
+        write_from(w, s->lru, w->batch_nmemb * SCAN_FACTOR, w->batch_nmemb, &written) != 0) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    // A free or invalidated slot may still carry the bit of its previous key
+    i = lru_cache_put_hashed(s, key, hash);
+    clear_dirty(w, i);
+
+    *put = true;
+    return i;
+}
+
+void lru_cache_writeback_mark_dirty(struct lru_cache_writeback *w, uint32_t i)
+{
+    assert(i < w->nmemb);
+
+    if (!lru_cache_writeback_is_dirty(w, i)) {
+        w->dirty[i / 64] |= 1ull << (i % 64);
+        w->ndirty++;
+    }
+}
+
+bool lru_cache_writeback_is_dirty(const struct lru_cache_writeback *w, uint32_t i)
+{
+    return (w->dirty[i / 64] >> (i % 64)) & 1;
+}
+
+uint32_t lru_cache_writeback(struct lru_cache_writeback *w, uint32_t budget)
+{
+    uint32_t written = 0;
+
+    if (w->ndirty > 0 && lru_cache_is_full(w->s)) {
+        write_from(w, w->s->lru, budget, UINT32_MAX, &written);
+    }
+
+    return written;
+}
+
+int lru_cache_writeback_sync(struct lru_cache_writeback *w)
+{
+    struct lru_cache *s = w->s;
+    uint32_t written = 0;
+    uint32_t n = 0;
+    uint32_t i;
+    int rv;
+
+    if (w->ndirty == 0) {
+        return 0;
+    }
+
+    if ((rv = write_from(w, first_live(s), UINT32_MAX, UINT32_MAX, &written)) != 0) {
+        return rv;
+    }
+
+    // Left are entries outside the recency order: pinned or loading ones, and invalidated ones
+    for (i = 0; i < w->nmemb && w->ndirty > n; i++) {
+        if (!lru_cache_writeback_is_dirty(w, i)) {
+            continue;
+        }
+
+        if (lru_cache_get_entry(s, i)->mru != i) {
+            clear_dirty(w, i);
+            continue;
+        }
+
+        w->batch[n++] = i;
+
+        if (n == w->batch_nmemb) {
+            if ((rv = write_batch(w, n)) != 0) {
+                return rv;
+            }
+
+            n = 0;
+        }
+    }
+
+    return write_batch(w, n);
+}
+
+int lru_cache_writeback_flush(struct lru_cache_writeback *w)
+{
+    int rv = lru_cache_writeback_sync(w);
+
+    if (rv != 0) {
+        return rv;
+    }
+
+    lru_cache_flush(w->s);
+    return 0;
+}
@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE
+
 #include "lru-cache.h"
 
 #include <stdio.h>
@@ -6,6 +8,24 @@
 #include <assert.h>
 #include <memory.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+// Relaxed loads of fields the writer may change during a read section
+#define LOAD(X) __atomic_load_n(&(X), __ATOMIC_RELAXED)
+
+// Entries ahead of lru_cache_bulk_load whose bucket is prefetched
+#define PREFETCH_DISTANCE 16
+
+#define ROTL64(X, B) (((X) << (B)) | ((X) >> (64 - (B))))
+
+#define SIPROUND(V0, V1, V2, V3) \
+    do { \
+        V0 += V1; V1 = ROTL64(V1, 13); V1 ^= V0; V0 = ROTL64(V0, 32); \
+        V2 += V3; V3 = ROTL64(V3, 16); V3 ^= V2; \
+        V0 += V3; V3 = ROTL64(V3, 21); V3 ^= V0; \
+        V2 += V1; V1 = ROTL64(V1, 17); V1 ^= V2; V2 = ROTL64(V2, 32); \
+    } while (0)
 
 uint64_t lru_cache_fnv1a64_step(uint64_t state, const void *data, size_t size)
 {
@@ -21,6 +41,88 @@ uint64_t lru_cache_djb2_step(uint64_t state, const void *data, size_t size)
     return state;
 }
 
+uint64_t lru_cache_siphash13(const uint64_t key[2], const void *data, size_t size)
+{
+    const unsigned char *d = (const unsigned char *)data;
+    uint64_t v0 = 0x736f6d6570736575ull ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dull ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ull ^ key[0];
+    uint64_t v3 = 0x7465646279746573ull ^ key[1];
+    uint64_t m;
+    uint64_t b = (uint64_t)size << 56;
+    size_t i;
+
+    for (; size >= 8; size -= 8, d += 8) {
+        for (m = 0, i = 0; i < 8; i++) {
+            m |= (uint64_t)d[i] << (8 * i);
+        }
+
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    for (i = 0; i < size; i++) {
+        b |= (uint64_t)d[i] << (8 * i);
+    }
+
+    v3 ^= b;
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static void reseed(struct lru_cache *s)
+{
+    struct timespec ts;
+
+    if (getentropy(s->seed, sizeof(s->seed)) == 0) {
+        return;
+    }
+
+    // No entropy source, at least differ between caches and calls
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    s->seed[0] = lru_cache_fnv1a64_step(s->seed[0] ^ LRU_CACHE_FNV1A64_IV, &ts, sizeof(ts));
+    s->seed[1] = lru_cache_fnv1a64_step(s->seed[1] ^ s->seed[0], &s, sizeof(s));
+}
+
+static uint32_t key_hash(const struct lru_cache *s, const void *key)
+{
+    return s->hash ? s->hash(key) : (uint32_t)lru_cache_siphash13(s->seed, key, s->size);
+}
+
+static uint32_t bucket(const struct lru_cache *s, const void *key)
+{
+    return key_hash(s, key) & (s->nbuckets - 1);
+}
+
+static bool has_detached(const struct lru_cache *s)
+{
+    // Entries being loaded or pinned are outside the global chain, see lru_cache_load_begin
+    return s->loading > 0 || s->pinned > 0;
+}
+
+static bool is_detached(const struct lru_cache_entry *e, uint32_t i)
+{
+    // Detached and still in a collision chain, lru_cache_flush_lazy unlinks the others
+    return e->mru == i && e->clru != i;
+}
+
+static void untag_if_empty(struct lru_cache *s, uint32_t hash)
+{
+    // Tags of removed keys are only cleared once their chain is empty, until then they cause extra walks
+    if (s->hashmap[hash] == LRU_CACHE_ENTRY_NIL) {
+        lru_cache_get_tags(s->hashmap, s->nbuckets)[hash] = 0;
+    }
+}
+
 static void remove_from_global_chain(struct lru_cache *s, struct lru_cache_entry *e)
 {
     if (e->lru != LRU_CACHE_ENTRY_NIL) {
@@ -39,6 +141,32 @@ static void remove_from_global_chain(struct lru_cache *s, struct lru_cache_entry
     e->lru = LRU_CACHE_ENTRY_NIL;
 }
 
+static void insert_as_lru(struct lru_cache *s, uint32_t i, struct lru_cache_entry *e)
+{
+    if (s->lru != LRU_CACHE_ENTRY_NIL) {
+        lru_cache_get_entry(s, s->lru)->lru = i;
+    } else {
+        s->mru = i;
+    }
+
+    e->mru = s->lru;
+    e->lru = LRU_CACHE_ENTRY_NIL;
+    s->lru = i;
+}
+
+static void insert_as_mru(struct lru_cache *s, uint32_t i, struct lru_cache_entry *e)
+{
+    if (s->mru != LRU_CACHE_ENTRY_NIL) {
+        lru_cache_get_entry(s, s->mru)->mru = i;
+    } else {
+        s->lru = i;
+    }
+
+    e->lru = s->mru;
+    e->mru = LRU_CACHE_ENTRY_NIL;
+    s->mru = i;
+}
+
 static void update_local_chain(
     struct lru_cache *s,
     uint32_t i,
@@ -84,7 +212,7 @@ static void update_local_chain(
     *index = i;
 }
 
-uint32_t lru_cache_update_entry(
+static uint32_t update_entry(
     struct lru_cache *s,
     uint32_t i,
     struct lru_cache_entry *e,
@@ -104,6 +232,10 @@ uint32_t lru_cache_update_entry(
 
     update_local_chain(s, i, e, old_hash, new_hash);
 
+    if (old_hash != new_hash) {
+        untag_if_empty(s, old_hash);
+    }
+
     assert((e->clru == LRU_CACHE_ENTRY_NIL) || (lru_cache_get_entry(s, e->clru)->cmru == i));
     assert((e->cmru == LRU_CACHE_ENTRY_NIL) || (lru_cache_get_entry(s, e->cmru)->clru == i));
 
@@ -116,9 +248,33 @@ uint32_t lru_cache_update_entry(
     return i;
 }
 
+uint32_t lru_cache_update_entry(
+    struct lru_cache *s,
+    uint32_t i,
+    struct lru_cache_entry *e,
+    uint32_t old_hash,
+    uint32_t new_hash)
+{
+    update_entry(s, i, e, old_hash, new_hash);
+
+    // Only the bucket is known here, so a moved entry sets every tag of its new chain
+    if (old_hash != new_hash && new_hash != LRU_CACHE_ENTRY_NIL) {
+        lru_cache_get_tags(s->hashmap, s->nbuckets)[new_hash] = UINT16_MAX;
+    }
+
+    return i;
+}
+
 int lru_cache_align(uint32_t size, uint32_t align, uint32_t *aligned_size_)
 {
     uint32_t aligned_size = (size + align - 1) & ~(align - 1);
+    uint64_t stride;
+
+    // Beyond the header size, the key is padded so that the entry stride is a multiple of align
+    if (align > sizeof(struct lru_cache_entry)) {
+        stride = ((uint64_t)size + sizeof(struct lru_cache_entry) + align - 1) & ~(uint64_t)(align - 1);
+        aligned_size = (stride - sizeof(struct lru_cache_entry) > UINT32_MAX) ? 0 : (uint32_t)(stride - sizeof(struct lru_cache_entry));
+    }
 
     if (aligned_size_) {
         *aligned_size_ = aligned_size;
@@ -128,13 +284,67 @@ int lru_cache_align(uint32_t size, uint32_t align, uint32_t *aligned_size_)
         return EOVERFLOW;
     }
 
-    if (size == 0 || align == 0 || align > sizeof(struct lru_cache_entry)) {
+    if (size == 0 || align == 0 || (align & (align - 1)) != 0 || align > LRU_CACHE_ALIGN_MAX) {
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static size_t padding(const struct lru_cache *s)
+{
+    // Shifts the entries so their keys, not their headers, start at the aligned cache memory
+    return (s->align > sizeof(struct lru_cache_entry)) ? s->align - sizeof(struct lru_cache_entry) : 0;
+}
+
+int lru_cache_set_align(struct lru_cache *s, uint32_t align)
+{
+    if (align == 0 || (align & (align - 1)) != 0 || align > LRU_CACHE_ALIGN_MAX) {
+        return EINVAL;
+    }
+
+    if ((sizeof(struct lru_cache_entry) + s->size) % align != 0) {
         return EINVAL;
     }
 
+    if (s->nmemb != 0 || s->try_nmemb != 0) {
+        return EBUSY;
+    }
+
+    s->align = align;
     return 0;
 }
 
+static bool keys_equal(const struct lru_cache *s, const void *a, const void *b)
+{
+    /*
+     * Without a comparison function, keys are compared in blocks of 32 bytes with no branch inside a
+     * block, which compilers turn into a few vector compares, unaligned for the probe key.
+     */
+    const unsigned char *p = a;
+    const unsigned char *q = b;
+    uint64_t x, y, diff;
+    uint32_t i, j;
+
+    if (s->compare) {
+        return s->compare(a, b) == 0;
+    }
+
+    for (i = 0; i + 32 <= s->size; i += 32) {
+        for (diff = 0, j = 0; j < 32; j += 8) {
+            memcpy(&x, p + i + j, sizeof(x));
+            memcpy(&y, q + i + j, sizeof(y));
+            diff |= x ^ y;
+        }
+
+        if (diff != 0) {
+            return false;
+        }
+    }
+
+    return memcmp(p + i, q + i, s->size - i) == 0;
+}
+
 int lru_cache_init(
     struct lru_cache *s,
     uint32_t aligned_size,
@@ -146,10 +356,6 @@ int lru_cache_init(
         return EINVAL;
     }
 
-    if (compare == NULL || hash == NULL) {
-        return EINVAL;
-    }
-
     s->hashmap = NULL;
     s->cache = NULL;
 
@@ -158,10 +364,38 @@ int lru_cache_init(
     s->hash = hash;
 
     s->size = aligned_size;
+    s->align = 1;
     s->nmemb = 0;
+    s->try_nmemb = 0;
+    s->nbuckets = 0;
+    s->try_nbuckets = 0;
+    s->load_factor = LRU_CACHE_LOAD_FACTOR_DEFAULT;
 
     s->lru = LRU_CACHE_ENTRY_NIL;
     s->mru = LRU_CACHE_ENTRY_NIL;
+    s->stale = LRU_CACHE_ENTRY_NIL;
+
+    s->evictions = NULL;
+    s->evictions_nmemb = 0;
+    s->evictions_head = 0;
+    s->evictions_count = 0;
+
+    s->loading = 0;
+    s->pinned = 0;
+    s->pin_limit = LRU_CACHE_PIN_LIMIT_DEFAULT;
+    s->trace = NULL;
+    s->trace_arg = NULL;
+
+    s->seed[0] = 0;
+    s->seed[1] = 0;
+    s->max_chain = LRU_CACHE_MAX_CHAIN_DEFAULT;
+    s->reseeds = 0;
+    s->seq = 0;
+
+    if (hash == NULL) {
+        reseed(s);
+    }
+
     return 0;
 }
 
@@ -169,10 +403,15 @@ bool lru_cache_is_full(
     struct lru_cache *s)
 {
     struct lru_cache_entry *entry = lru_cache_get_entry(s, s->lru);
-    return (entry == NULL) || (entry->clru != s->lru);
+    return (entry == NULL) || (entry->clru != s->lru && s->stale == LRU_CACHE_ENTRY_NIL);
 }
 
-int lru_cache_calc_sizes(size_t aligned_size, size_t nmemb, size_t *hashmap_bytes, size_t *cache_bytes)
+int lru_cache_calc_sizes(
+    size_t aligned_size,
+    size_t nmemb,
+    uint32_t load_factor,
+    size_t *hashmap_bytes,
+    size_t *cache_bytes)
 {
     uint32_t nmemb_max = SIZE_MAX / (sizeof(struct lru_cache_entry) + aligned_size);
 
@@ -185,7 +424,7 @@ int lru_cache_calc_sizes(size_t aligned_size, size_t nmemb, size_t *hashmap_byte
     }
 
     if (hashmap_bytes) {
-        *hashmap_bytes = nmemb * sizeof(uint32_t);
+        *hashmap_bytes = (size_t)lru_cache_calc_nbuckets(nmemb, load_factor) * LRU_CACHE_BUCKET_SIZE;
     }
 
     if (cache_bytes) {
@@ -195,6 +434,50 @@ int lru_cache_calc_sizes(size_t aligned_size, size_t nmemb, size_t *hashmap_byte
     return 0;
 }
 
+static void link_entry(struct lru_cache *s, uint32_t i, struct lru_cache_entry *e, uint16_t *tags)
+{
+    uint32_t hash = key_hash(s, e->key);
+
+    tags[hash & (s->nbuckets - 1)] |= lru_cache_tag(hash);
+    hash &= s->nbuckets - 1;
+
+    e->clru = s->hashmap[hash];
+    e->cmru = LRU_CACHE_ENTRY_NIL;
+
+    if (e->clru != LRU_CACHE_ENTRY_NIL) {
+        lru_cache_get_entry(s, e->clru)->cmru = i;
+    }
+
+    s->hashmap[hash] = i;
+}
+
+static void rebuild_hashmap(struct lru_cache *s)
+{
+    uint32_t i;
+    uint32_t first = LRU_CACHE_ENTRY_NIL;
+    uint16_t *tags = lru_cache_get_tags(s->hashmap, s->nbuckets);
+    struct lru_cache_entry *e;
+
+    memset(s->hashmap, 0xff, s->nbuckets * sizeof(*s->hashmap));
+    memset(tags, 0, s->nbuckets * sizeof(*tags));
+
+    // Relink from LRU to MRU, so the most recently used entry ends up first in its chain
+    LRU_CACHE_ITERATE_MRU_TO_LRU(s, i, e) {
+        first = i;
+    }
+
+    for (i = first; (e = lru_cache_get_entry(s, i)); i = e->mru) {
+        link_entry(s, i, e, tags);
+    }
+
+    // Entries being loaded or pinned are not in the global chain, only a scan finds them
+    for (i = 0; has_detached(s) && i < s->nmemb; i++) {
+        if (is_detached((e = lru_cache_get_entry(s, i)), i)) {
+            link_entry(s, i, e, tags);
+        }
+    }
+}
+
 int lru_cache_set_nmemb(
     struct lru_cache *s,
     uint32_t nmemb,
@@ -203,68 +486,127 @@ int lru_cache_set_nmemb(
 {
     int rv = 0;
     uint32_t i;
-    uint32_t old_hash;
-    uint32_t new_hash;
+    uint32_t hash;
+    uint32_t nbuckets = lru_cache_calc_nbuckets(nmemb, s->load_factor);
+    uint16_t *tags;
     struct lru_cache_entry *e;
 
-    rv = lru_cache_calc_sizes(s->size, nmemb, hashmap_bytes, cache_bytes);
+    rv = lru_cache_calc_sizes(s->size, nmemb, s->load_factor, hashmap_bytes, cache_bytes);
     if (rv != 0) {
         return rv;
     }
 
+    if (cache_bytes) {
+        if (SIZE_MAX - *cache_bytes < padding(s)) {
+            return EOVERFLOW;
+        }
+
+        *cache_bytes += padding(s);
+    }
+
+    // Buckets are split or folded in place, which cannot go against the direction of the resize
+    if ((nmemb < s->nmemb) ? (nbuckets > s->nbuckets) : (nbuckets < s->nbuckets)) {
+        nbuckets = s->nbuckets;
+    }
+
+    if (hashmap_bytes) {
+        *hashmap_bytes = (size_t)nbuckets * LRU_CACHE_BUCKET_SIZE;
+    }
+
+    if (nmemb < s->nmemb && has_detached(s)) {
+        // Entries being loaded or pinned cannot move, and at least one entry must stay evictable
+        if (nmemb <= s->loading + s->pinned) {
+            return EBUSY;
+        }
+
+        for (i = nmemb; i < s->nmemb; i++) {
+            if (lru_cache_get_entry(s, i)->mru == i) {
+                return EBUSY;
+            }
+        }
+    }
+
     if (nmemb < s->nmemb) {
+        lru_cache_drain_flush(s, UINT32_MAX);
+        lru_cache_drain_evictions(s, UINT32_MAX);
+
         for (i = nmemb; i < s->nmemb; i++) {
             e = lru_cache_get_entry(s, i);
-            old_hash = s->hash(e->key, s->nmemb);
+            hash = (e->clru != i) ? bucket(s, e->key) : 0;
 
             if (e->clru != i && s->destroy) {
                 s->destroy(e->key, i);
             }
 
             remove_from_global_chain(s, e);
-            update_local_chain(s, i, e, old_hash, LRU_CACHE_ENTRY_NIL);
+            update_local_chain(s, i, e, hash, LRU_CACHE_ENTRY_NIL);
         }
 
         assert(s->lru < nmemb);
         assert(s->mru < nmemb);
 
-        for (i = s->mru; (e = lru_cache_get_entry(s, i)) && e->clru != i; i = e->lru) {
+        // Fold the upper half of the buckets into the lower half, which is kept by realloc
+        tags = lru_cache_get_tags(s->hashmap, s->nbuckets);
+
+        for (i = s->mru; nbuckets != s->nbuckets && (e = lru_cache_get_entry(s, i)) && e->clru != i; i = e->lru) {
             assert(i < s->nmemb);
 
-            old_hash = s->hash(e->key, s->nmemb);
-            new_hash = s->hash(e->key, nmemb);
-            update_local_chain(s, i, e, old_hash, new_hash);
+            hash = key_hash(s, e->key);
+            update_local_chain(s, i, e, hash & (s->nbuckets - 1), hash & (nbuckets - 1));
+            tags[hash & (nbuckets - 1)] |= lru_cache_tag(hash);
+        }
+
+        for (i = 0; nbuckets != s->nbuckets && has_detached(s) && i < nmemb; i++) {
+            if (is_detached((e = lru_cache_get_entry(s, i)), i)) {
+                hash = key_hash(s, e->key);
+                update_local_chain(s, i, e, hash & (s->nbuckets - 1), hash & (nbuckets - 1));
+                tags[hash & (nbuckets - 1)] |= lru_cache_tag(hash);
+            }
+        }
+
+        // The filters move down to follow the chain heads, over the heads of the folded buckets
+        if (nbuckets != s->nbuckets) {
+            memmove(lru_cache_get_tags(s->hashmap, nbuckets), tags, nbuckets * sizeof(*tags));
         }
 
         s->nmemb = nmemb;
+        s->nbuckets = nbuckets;
     }
 
     s->try_nmemb = nmemb;
+    s->try_nbuckets = nbuckets;
     return rv;
 }
 
 int lru_cache_set_memory(struct lru_cache *s, void *hashmap, void *cache)
 {
     uint32_t i;
-    uint32_t old_hash;
-    uint32_t new_hash;
+    uint32_t hash;
+    uint16_t *tags;
     struct lru_cache_entry *e;
 
-    size_t hashmap_bytes = s->try_nmemb * sizeof(*s->hashmap);
-    size_t cache_bytes = s->try_nmemb * (sizeof(struct lru_cache_entry) + s->size);
+    size_t hashmap_bytes = (size_t)s->try_nbuckets * LRU_CACHE_BUCKET_SIZE;
+    size_t cache_bytes = s->try_nmemb * (sizeof(struct lru_cache_entry) + s->size) + padding(s);
 
     if (UINTPTR_MAX - (uintptr_t)cache < cache_bytes) {
         return EOVERFLOW;
     }
 
+    if ((uintptr_t)cache % s->align != 0) {
+        return EINVAL;
+    }
+
     if (UINTPTR_MAX - (uintptr_t)hashmap < hashmap_bytes) {
         return EOVERFLOW;
     }
 
     s->hashmap = hashmap;
-    s->cache = cache;
+    s->cache = (char *)cache + padding(s);
 
     if (s->nmemb < s->try_nmemb) {
+        lru_cache_drain_flush(s, UINT32_MAX);
+        lru_cache_drain_evictions(s, UINT32_MAX);
+
         for (i = s->nmemb; i < s->try_nmemb; i++) {
             e = lru_cache_get_entry(s, i);
 
@@ -280,8 +622,15 @@ int lru_cache_set_memory(struct lru_cache *s, void *hashmap, void *cache)
              */
             e->clru = i;
             e->cmru = LRU_CACHE_ENTRY_NIL;
+        }
+
+        // The filters move up to make room for the new chain heads, which overwrite their old place
+        tags = lru_cache_get_tags(s->hashmap, s->try_nbuckets);
+        memmove(tags, lru_cache_get_tags(s->hashmap, s->nbuckets), s->nbuckets * sizeof(*tags));
 
+        for (i = s->nbuckets; i < s->try_nbuckets; i++) {
             s->hashmap[i] = LRU_CACHE_ENTRY_NIL;
+            tags[i] = 0;
         }
 
         if (s->lru != LRU_CACHE_ENTRY_NIL) {
@@ -294,15 +643,30 @@ int lru_cache_set_memory(struct lru_cache *s, void *hashmap, void *cache)
             s->mru = s->try_nmemb - 1;
         }
 
-        for (i = s->mru; (e = lru_cache_get_entry(s, i)) && e->clru != i; i = e->lru) {
+        // Split every bucket into itself and its new counterpart in the upper half
+        for (i = s->mru; s->try_nbuckets != s->nbuckets && (e = lru_cache_get_entry(s, i)) && e->clru != i; i = e->lru) {
             assert(i < s->nmemb && i < s->try_nmemb);
 
-            old_hash = s->hash(e->key, s->nmemb);
-            new_hash = s->hash(e->key, s->try_nmemb);
-            update_local_chain(s, i, e, old_hash, new_hash);
+            hash = key_hash(s, e->key);
+            update_local_chain(s, i, e, hash & (s->nbuckets - 1), hash & (s->try_nbuckets - 1));
+            tags[hash & (s->try_nbuckets - 1)] |= lru_cache_tag(hash);
+        }
+
+        for (i = 0; s->try_nbuckets != s->nbuckets && has_detached(s) && i < s->nmemb; i++) {
+            if (is_detached((e = lru_cache_get_entry(s, i)), i)) {
+                hash = key_hash(s, e->key);
+                update_local_chain(s, i, e, hash & (s->nbuckets - 1), hash & (s->try_nbuckets - 1));
+                tags[hash & (s->try_nbuckets - 1)] |= lru_cache_tag(hash);
+            }
         }
 
-        s->nmemb = s->try_nmemb;
+        // Readers in lru_cache_find must see the new memory before the larger sizes
+        __atomic_store_n(&s->nmemb, s->try_nmemb, __ATOMIC_RELEASE);
+        __atomic_store_n(&s->nbuckets, s->try_nbuckets, __ATOMIC_RELEASE);
+    } else if (s->nbuckets != s->try_nbuckets) {
+        // Load factor changed through lru_cache_set_load_factor
+        __atomic_store_n(&s->nbuckets, s->try_nbuckets, __ATOMIC_RELEASE);
+        rebuild_hashmap(s);
     }
 
     // guaranteed by correct order of set_nmemb and set_memory
@@ -310,6 +674,38 @@ int lru_cache_set_memory(struct lru_cache *s, void *hashmap, void *cache)
     return 0;
 }
 
+int lru_cache_set_load_factor(struct lru_cache *s, uint32_t load_factor, size_t *hashmap_bytes)
+{
+    if (load_factor == 0) {
+        return EINVAL;
+    }
+
+    if (s->try_nmemb != s->nmemb) {
+        return EBUSY;
+    }
+
+    s->load_factor = load_factor;
+    s->try_nbuckets = lru_cache_calc_nbuckets(s->nmemb, load_factor);
+
+    if (hashmap_bytes) {
+        *hashmap_bytes = (size_t)s->try_nbuckets * LRU_CACHE_BUCKET_SIZE;
+    }
+
+    return 0;
+}
+
+int lru_cache_set_hashmap(struct lru_cache *s, void *hashmap)
+{
+    if (hashmap == NULL) {
+        return EINVAL;
+    }
+
+    s->hashmap = hashmap;
+    __atomic_store_n(&s->nbuckets, s->try_nbuckets, __ATOMIC_RELEASE);
+    rebuild_hashmap(s);
+    return 0;
+}
+
 struct lru_cache_entry *lru_cache_get_entry(struct lru_cache *s, uint32_t i)
 {
     char *cache = s->cache;
@@ -317,90 +713,705 @@ struct lru_cache_entry *lru_cache_get_entry(struct lru_cache *s, uint32_t i)
     return (i != LRU_CACHE_ENTRY_NIL) ? (struct lru_cache_entry *)(cache + offset) : NULL;
 }
 
-uint32_t lru_cache_put(struct lru_cache *s, const void *key)
+static uint32_t complete_eviction(struct lru_cache *s)
 {
-    // 11. Cache miss -- determine insertion mode
-    uint32_t i = s->lru;
+    uint32_t i = s->evictions[s->evictions_head];
     struct lru_cache_entry *e = lru_cache_get_entry(s, i);
-    uint32_t new_hash = s->hash(key, s->nmemb);
-    uint32_t old_hash = new_hash;
 
-    if (e->clru != i) {
-        old_hash = s->hash(e->key, s->nmemb);
+    s->evictions_head = (s->evictions_head + 1) % s->evictions_nmemb;
+    s->evictions_count--;
 
-        if (s->destroy) {
-            s->destroy(e->key, i);
-        }
+    if (s->destroy) {
+        s->destroy(e->key, i);
     }
 
-    memcpy(e->key, key, s->size);
-    return lru_cache_update_entry(s, i, e, old_hash, new_hash);
+    // Slot becomes available again only now
+    insert_as_lru(s, i, e);
+    return i;
 }
 
-// @todo: Atomic access
-uint32_t lru_cache_get_or_put(struct lru_cache *s, const void *key, bool *put)
+static void evict_ahead(struct lru_cache *s)
 {
-    if (s->nmemb == 0) {
-        return LRU_CACHE_ENTRY_NIL;
-    }
-
-    // 3. Extract Components
-    uint32_t new_hash = s->hash(key, s->nmemb);
-    uint32_t old_hash = new_hash;
-    uint32_t i = s->hashmap[new_hash];
-    struct lru_cache_entry *e = NULL;
+    /*
+     * Once the last free entry has been used, move LRU entries into the eviction ring buffer until
+     * it is full. They are removed from both chains, so lookups miss and lru_cache_put cannot reuse
+     * their slots before lru_cache_drain_evictions (or backpressure in lru_cache_put) destroys them.
+     * The entries in the ring buffer are capacity the cache gives up, see lru_cache_set_evictions.
+     */
+    uint32_t i;
+    uint32_t old_hash;
+    struct lru_cache_entry *e;
 
-    // 4. Check for cache hit
-    while ((e = lru_cache_get_entry(s, i))) {
-        if (s->compare(e->key, key) == 0) {
-            if (put) {
-                *put = false;
-            }
+    while (s->evictions_count < s->evictions_nmemb && s->lru != s->mru && s->stale == LRU_CACHE_ENTRY_NIL) {
+        i = s->lru;
+        e = lru_cache_get_entry(s, i);
 
-            // 8. Protomote to LRU
-            return lru_cache_update_entry(s, i, e, old_hash, new_hash);
+        if (e->clru == i) {
+            break;
         }
 
-        i = e->clru;
+        old_hash = bucket(s, e->key);
+        update_local_chain(s, i, e, old_hash, LRU_CACHE_ENTRY_NIL);
+        untag_if_empty(s, old_hash);
+        remove_from_global_chain(s, e);
+
+        s->evictions[(s->evictions_head + s->evictions_count) % s->evictions_nmemb] = i;
+        s->evictions_count++;
     }
+}
 
-    if (!put) {
-        return LRU_CACHE_ENTRY_NIL;
+uint32_t lru_cache_drain_evictions(struct lru_cache *s, uint32_t budget)
+{
+    uint32_t n;
+
+    for (n = 0; n < budget && s->evictions_count > 0; n++) {
+        complete_eviction(s);
     }
 
-    *put = true;
-    return lru_cache_put(s, key);
+    return n;
 }
 
-void lru_cache_flush(struct lru_cache *s)
+int lru_cache_set_evictions(struct lru_cache *s, uint32_t *evictions, uint32_t nmemb)
 {
-    /*
-     * When flushing the cache, there are three possible strategies:
-     *
-     * 1. Iterate through all entries, remove them, and reinsert in LRU -> MRU order (mapped to 0 -> N)
-     *  + Ensures entries are inserted in order (0, 1, ..., N) for better memory locality
-     *  - More costly since all entries must be removed and reinserted
-     *  * Old access order is lost, which may negatively impact CPU cache performance
-     *
-     * 2. Iterate from 0 to N, destroying only used entries and removing them from the collision chain
-     *  + Accesses entries in sequential order (0 -> N), improving CPU cache efficiency
-     *  - May unnecessarily iterate over empty entries if the cache is not full
-     *
-     * 3. Iterate from MRU -> LRU, stopping at the first uninitialized entry
-     *  + Stops early if there are unused entries, saving time
-     *  - Traversal is not sequential in memory, which may reduce CPU cache efficiency
-     */
-    uint32_t i;
-    uint32_t old_hash;
-    struct lru_cache_entry *e;
+    if (evictions == NULL && nmemb != 0) {
+        return EINVAL;
+    }
 
-    for (i = s->mru; (e = lru_cache_get_entry(s, i)) && e->clru != i; i = e->lru) {
-        old_hash = s->hash(e->key, s->nmemb);
+    lru_cache_drain_evictions(s, UINT32_MAX);
+
+    s->evictions = evictions;
+    s->evictions_nmemb = nmemb;
+    s->evictions_head = 0;
+    return 0;
+}
+
+uint32_t lru_cache_put_hashed(struct lru_cache *s, const void *key, uint32_t hash)
+{
+    // 11. Cache miss -- determine insertion mode
+    uint32_t i = s->lru;
+    struct lru_cache_entry *e = lru_cache_get_entry(s, i);
+    uint32_t new_hash = hash & (s->nbuckets - 1);
+    uint32_t old_hash = new_hash;
+
+    if (e->clru != i && s->stale == LRU_CACHE_ENTRY_NIL && s->evictions_count > 0) {
+        // Evictions were not drained in time, reuse the slot of the oldest one
+        i = complete_eviction(s);
+        e = lru_cache_get_entry(s, i);
+    }
+
+    if (e->clru != i) {
+        if (s->stale != LRU_CACHE_ENTRY_NIL) {
+            // Invalidated by lru_cache_flush_lazy, the collision chain is already gone
+            s->stale = (s->stale != i) ? s->stale : LRU_CACHE_ENTRY_NIL;
+            e->clru = i;
+            e->cmru = LRU_CACHE_ENTRY_NIL;
+        } else {
+            old_hash = bucket(s, e->key);
+        }
 
         if (s->destroy) {
             s->destroy(e->key, i);
         }
+    }
 
-        update_local_chain(s, i, e, old_hash, LRU_CACHE_ENTRY_NIL);
+    memcpy(e->key, key, s->size);
+    update_entry(s, i, e, old_hash, new_hash);
+    lru_cache_get_tags(s->hashmap, s->nbuckets)[new_hash] |= lru_cache_tag(hash);
+
+    if (s->evictions_nmemb > 0) {
+        evict_ahead(s);
+    }
+
+    return i;
+}
+
+uint32_t lru_cache_put(struct lru_cache *s, const void *key)
+{
+    return lru_cache_put_hashed(s, key, key_hash(s, key));
+}
+
+uint32_t lru_cache_hash(const struct lru_cache *s, const void *key)
+{
+    return key_hash(s, key);
+}
+
+static void guard_chain(struct lru_cache *s, uint32_t chain)
+{
+    /*
+     * With a random key, long chains only occur by chance or if the key has leaked. Rehashing with a
+     * new key is a one-off O(nmemb) cost that keeps every later lookup within the bound.
+     */
+    if (s->hash != NULL || chain <= s->max_chain + s->nmemb / s->nbuckets) {
+        return;
+    }
+
+    reseed(s);
+    rebuild_hashmap(s);
+    s->reseeds++;
+}
+
+static uint32_t get_or_put_hashed(struct lru_cache *s, const void *key, uint32_t hash, bool *put)
+{
+    // 3. Extract Components
+    uint32_t new_hash = hash & (s->nbuckets - 1);
+    uint32_t old_hash = new_hash;
+    uint32_t chain = 0;
+    struct lru_cache_entry *e = NULL;
+
+    // No key in the chain has the tag of this one, a miss without touching any entry
+    uint32_t i = (lru_cache_get_tags(s->hashmap, s->nbuckets)[new_hash] & lru_cache_tag(hash)) ? s->hashmap[new_hash] : LRU_CACHE_ENTRY_NIL;
+
+    // 4. Check for cache hit
+    while ((e = lru_cache_get_entry(s, i))) {
+        if (keys_equal(s, e->key, key)) {
+            if (put) {
+                *put = false;
+            }
+
+            if (s->trace) {
+                s->trace(s->trace_arg, key, hash, true);
+            }
+
+            // Being loaded or pinned, not part of the global chain until lru_cache_load_end or unpin
+            if (e->mru == i) {
+                return i;
+            }
+
+            // 8. Protomote to LRU
+            i = update_entry(s, i, e, old_hash, new_hash);
+            guard_chain(s, chain);
+            return i;
+        }
+
+        i = e->clru;
+        chain++;
+    }
+
+    if (s->trace) {
+        s->trace(s->trace_arg, key, hash, false);
+    }
+
+    if (put) {
+        *put = true;
+        i = lru_cache_put_hashed(s, key, hash);
+    }
+
+    guard_chain(s, chain);
+    return i;
+}
+
+// @todo: Atomic access
+uint32_t lru_cache_get_or_put(struct lru_cache *s, const void *key, bool *put)
+{
+    if (s->nmemb == 0) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    return get_or_put_hashed(s, key, key_hash(s, key), put);
+}
+
+uint32_t lru_cache_get_hashed(struct lru_cache *s, const void *key, uint32_t *hash)
+{
+    uint32_t reseeds = s->reseeds;
+    uint32_t i;
+
+    *hash = key_hash(s, key);
+
+    if (s->nmemb == 0) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    i = get_or_put_hashed(s, key, *hash, NULL);
+
+    // A long chain may have reseeded the built-in hash, the caller needs the hash under the new key
+    if (s->reseeds != reseeds) {
+        *hash = key_hash(s, key);
+    }
+
+    return i;
+}
+
+static void append_segment(struct lru_cache *s, uint32_t i, struct lru_cache_entry *e, uint32_t *lru, uint32_t *mru)
+{
+    if (*mru != LRU_CACHE_ENTRY_NIL) {
+        lru_cache_get_entry(s, *mru)->mru = i;
+    } else {
+        *lru = i;
+    }
+
+    e->lru = *mru;
+    e->mru = LRU_CACHE_ENTRY_NIL;
+    *mru = i;
+}
+
+int lru_cache_bulk_load(struct lru_cache *s, const void *keys, uint32_t n, const uint32_t *hashes)
+{
+    uint32_t i, k;
+    uint32_t hash;
+    uint32_t far, near;
+    uint32_t free_lru = LRU_CACHE_ENTRY_NIL, free_mru = LRU_CACHE_ENTRY_NIL;
+    uint32_t used_lru = LRU_CACHE_ENTRY_NIL, used_mru = LRU_CACHE_ENTRY_NIL;
+    uint16_t *tags;
+    uint32_t m, skip;
+    struct lru_cache_entry *e, *f;
+
+    if (hashes && s->hash == NULL) {
+        return EINVAL;
+    }
+
+    if (s->nmemb == 0) {
+        return 0;
+    }
+
+    lru_cache_drain_flush(s, UINT32_MAX);
+    lru_cache_drain_evictions(s, UINT32_MAX);
+
+    // Used entries are always at the MRU end, see lru_cache_flush_lazy
+    if (lru_cache_get_entry(s, s->mru)->clru != s->mru) {
+        return EBUSY;
+    }
+
+    // Entries being loaded or pinned are cached as well, unless a flush has unlinked them
+    for (i = 0; has_detached(s) && i < s->nmemb; i++) {
+        if (is_detached(lru_cache_get_entry(s, i), i)) {
+            return EBUSY;
+        }
+    }
+
+    // Unlinked ones keep their slot until lru_cache_load_end or the last unpin
+    m = s->nmemb - s->loading - s->pinned;
+    m = (n < m) ? n : m;
+    skip = n - m;
+
+    if (m == 0) {
+        return 0;
+    }
+
+    /*
+     * The first m entries that are not detached receive the keys and all others stay free, which
+     * lays out the global chain in index order within both segments, without detached entries:
+     *
+     *   LRU -> [free entries] -> [entries with keys] -> MRU
+     *
+     * The hash of each key is kept in cmru until its entry is linked into the hashmap below.
+     */
+    for (i = 0, k = 0; i < s->nmemb; i++) {
+        e = lru_cache_get_entry(s, i);
+
+        if (e->mru == i) {
+            continue;
+        }
+
+        if (k < m) {
+            memcpy(e->key, (const char *)keys + (size_t)(skip + k) * s->size, s->size);
+
+            e->clru = LRU_CACHE_ENTRY_NIL;
+            e->cmru = hashes ? hashes[skip + k] : key_hash(s, e->key);
+            append_segment(s, i, e, &used_lru, &used_mru);
+            k++;
+        } else {
+            e->clru = i;
+            e->cmru = LRU_CACHE_ENTRY_NIL;
+            append_segment(s, i, e, &free_lru, &free_mru);
+        }
+    }
+
+    if (free_mru != LRU_CACHE_ENTRY_NIL) {
+        lru_cache_get_entry(s, free_mru)->mru = used_lru;
+        lru_cache_get_entry(s, used_lru)->lru = free_mru;
+    }
+
+    s->lru = (free_lru != LRU_CACHE_ENTRY_NIL) ? free_lru : used_lru;
+    s->mru = used_mru;
+    tags = lru_cache_get_tags(s->hashmap, s->nbuckets);
+
+    memset(s->hashmap, 0xff, s->nbuckets * sizeof(*s->hashmap));
+    memset(tags, 0, s->nbuckets * sizeof(*tags));
+
+    /*
+     * Pushing in recency order leaves the most recently used entry first in its chain. The hashmap and
+     * previous chain heads are accessed at random, so both are prefetched ahead of the sequential walk.
+     */
+    far = near = used_lru;
+
+    for (k = 0; k < PREFETCH_DISTANCE; k++) {
+        far = (f = lru_cache_get_entry(s, far)) ? f->mru : LRU_CACHE_ENTRY_NIL;
+        near = (k < PREFETCH_DISTANCE / 2) ? far : near;
+    }
+
+    for (i = used_lru; (e = lru_cache_get_entry(s, i)); i = e->mru) {
+        if ((f = lru_cache_get_entry(s, far))) {
+            hash = f->cmru & (s->nbuckets - 1);
+            __builtin_prefetch(&s->hashmap[hash], 1);
+            __builtin_prefetch(&tags[hash], 1);
+            far = f->mru;
+        }
+
+        if ((f = lru_cache_get_entry(s, near))) {
+            hash = f->cmru & (s->nbuckets - 1);
+            __builtin_prefetch(lru_cache_get_entry(s, s->hashmap[hash]), 1);
+            near = f->mru;
+        }
+
+        hash = e->cmru & (s->nbuckets - 1);
+        tags[hash] |= lru_cache_tag(e->cmru);
+
+        e->clru = s->hashmap[hash];
+        s->hashmap[hash] = i;
+        e->cmru = LRU_CACHE_ENTRY_NIL;
+
+        if (e->clru != LRU_CACHE_ENTRY_NIL) {
+            lru_cache_get_entry(s, e->clru)->cmru = i;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t lru_cache_find(struct lru_cache *s, const void *key)
+{
+    /*
+     * Everything read here may be modified concurrently, so all indices are bounds checked and the
+     * chain walk is bounded; the result is only meaningful if lru_cache_read_retry returns false.
+     */
+    uint32_t n;
+    uint32_t nmemb = __atomic_load_n(&s->nmemb, __ATOMIC_ACQUIRE); // Pairs with lru_cache_set_memory
+    uint32_t nbuckets = __atomic_load_n(&s->nbuckets, __ATOMIC_ACQUIRE);
+    uint32_t *hashmap = LOAD(s->hashmap);
+    uint32_t hash;
+    uint32_t i;
+    struct lru_cache_entry *e;
+
+    if (nmemb == 0 || nbuckets == 0) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    hash = key_hash(s, key);
+
+    if ((LOAD(lru_cache_get_tags(hashmap, nbuckets)[hash & (nbuckets - 1)]) & lru_cache_tag(hash)) == 0) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    i = LOAD(hashmap[hash & (nbuckets - 1)]);
+
+    for (n = 0; n < nmemb && i < nmemb; n++) {
+        e = lru_cache_get_entry(s, i);
+
+        if ((LOAD(e->mru) != i || LOAD(e->lru) != LRU_CACHE_ENTRY_NIL) && keys_equal(s, e->key, key)) {
+            return i;
+        }
+
+        i = LOAD(e->clru);
+    }
+
+    return LRU_CACHE_ENTRY_NIL;
+}
+
+void lru_cache_touch(struct lru_cache *s, uint32_t i)
+{
+    struct lru_cache_entry *e = lru_cache_get_entry(s, i);
+
+    // Stale entries cannot be told apart from others, and must stay below the fresh ones
+    if (i >= s->nmemb || e->clru == i || e->mru == i || s->stale != LRU_CACHE_ENTRY_NIL || s->mru == i) {
+        return;
+    }
+
+    remove_from_global_chain(s, e);
+    insert_as_mru(s, i, e);
+}
+
+void lru_cache_demote(struct lru_cache *s, uint32_t i)
+{
+    struct lru_cache_entry *e = lru_cache_get_entry(s, i);
+
+    // Only a full cache has no free entries that must stay at the LRU end
+    if (i >= s->nmemb || e->clru == i || e->mru == i || !lru_cache_is_full(s) || s->lru == i) {
+        return;
+    }
+
+    remove_from_global_chain(s, e);
+    insert_as_lru(s, i, e);
+}
+
+uint32_t lru_cache_read_begin(const struct lru_cache *s)
+{
+    uint32_t seq;
+
+    while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1) {
+        // Writer active
+    }
+
+    return seq;
+}
+
+bool lru_cache_read_retry(const struct lru_cache *s, uint32_t seq)
+{
+    // Orders the reads of the section before the reload of the sequence count
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq;
+}
+
+void lru_cache_write_begin(struct lru_cache *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+
+    // Orders the odd sequence count before the writes of the section
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void lru_cache_write_end(struct lru_cache *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t lru_cache_load_begin(struct lru_cache *s, const void *key, enum lru_cache_load_state *state)
+{
+    bool put;
+    uint32_t i = lru_cache_get_or_put(s, key, &put);
+    struct lru_cache_entry *e = lru_cache_get_entry(s, i);
+
+    if (e == NULL) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    if (!put) {
+        *state = (e->mru == i && e->lru == LRU_CACHE_ENTRY_NIL) ? LRU_CACHE_LOAD_PENDING : LRU_CACHE_LOAD_HIT;
+        return i;
+    }
+
+    if (s->lru == i && s->evictions_count > 0) {
+        complete_eviction(s);
+    }
+
+    if (s->lru == i) {
+        // Every other entry is being loaded, detaching this one would leave nothing to evict
+        update_local_chain(s, i, e, bucket(s, e->key), LRU_CACHE_ENTRY_NIL);
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    /*
+     * While loading, the entry stays in its collision chain so concurrent lookups find it, but is
+     * removed from the global chain so it cannot be evicted. "e->mru == i" marks this state, which
+     * is shared with pinned entries; "e->lru" is LRU_CACHE_ENTRY_NIL here and the pin count there.
+     */
+    remove_from_global_chain(s, e);
+    e->mru = i;
+
+    s->loading++;
+    *state = LRU_CACHE_LOAD_MISS;
+    return i;
+}
+
+static bool in_chain(struct lru_cache *s, uint32_t i, uint32_t hash)
+{
+    uint32_t j;
+
+    for (j = s->hashmap[hash]; j != LRU_CACHE_ENTRY_NIL && j != i; j = lru_cache_get_entry(s, j)->clru);
+
+    return j == i;
+}
+
+uint32_t lru_cache_load_end(struct lru_cache *s, uint32_t i, bool loaded)
+{
+    struct lru_cache_entry *e = lru_cache_get_entry(s, i);
+    uint32_t hash = bucket(s, e->key);
+    bool reachable;
+
+    assert(e->mru == i);
+    s->loading--;
+
+    // A flush during the load has cleared the hashmap, the result must not be published then
+    reachable = in_chain(s, i, hash);
+
+    if (loaded && reachable) {
+        insert_as_mru(s, i, e);
+        return i;
+    }
+
+    if (loaded && s->destroy) {
+        s->destroy(e->key, i);
+    }
+
+    if (reachable) {
+        update_local_chain(s, i, e, hash, LRU_CACHE_ENTRY_NIL);
+    } else {
+        e->clru = i;
+        e->cmru = LRU_CACHE_ENTRY_NIL;
+    }
+
+    insert_as_lru(s, i, e);
+    return LRU_CACHE_ENTRY_NIL;
+}
+
+uint32_t lru_cache_get_or_load(struct lru_cache *s, const void *key, lru_cache_load_t load, bool *put)
+{
+    enum lru_cache_load_state state;
+    uint32_t i = lru_cache_load_begin(s, key, &state);
+
+    if (i == LRU_CACHE_ENTRY_NIL || state == LRU_CACHE_LOAD_PENDING) {
+        return LRU_CACHE_ENTRY_NIL;
+    }
+
+    if (put) {
+        *put = (state == LRU_CACHE_LOAD_MISS);
+    }
+
+    if (state == LRU_CACHE_LOAD_HIT) {
+        return i;
     }
+
+    return lru_cache_load_end(s, i, load(key, i) == 0);
+}
+
+int lru_cache_pin(struct lru_cache *s, uint32_t i)
+{
+    struct lru_cache_entry *e = lru_cache_get_entry(s, i);
+
+    if (i >= s->nmemb) {
+        return EINVAL;
+    }
+
+    // Already pinned, or being loaded; possibly unlinked by a flush since
+    if (e->mru == i) {
+        if (e->lru == LRU_CACHE_ENTRY_NIL) {
+            return EBUSY;
+        }
+
+        if (e->lru == LRU_CACHE_ENTRY_NIL - 1) {
+            return EOVERFLOW;
+        }
+
+        e->lru++;
+        return 0;
+    }
+
+    if (e->clru == i) {
+        return EINVAL;
+    }
+
+    // Stale entries of lru_cache_flush_lazy cannot be told apart otherwise
+    if (!in_chain(s, i, bucket(s, e->key))) {
+        return EINVAL;
+    }
+
+    // At least one entry must remain evictable
+    if (s->lru == s->mru || (uint64_t)(s->pinned + 1) * 100 > (uint64_t)s->nmemb * s->pin_limit) {
+        return EBUSY;
+    }
+
+    /*
+     * Like an entry being loaded, a pinned entry stays in its collision chain but leaves the global
+     * chain, so lru_cache_put never reaches it. The pin count is kept in the unused "e->lru".
+     */
+    remove_from_global_chain(s, e);
+    e->mru = i;
+    e->lru = 1;
+
+    s->pinned++;
+    return 0;
+}
+
+void lru_cache_unpin(struct lru_cache *s, uint32_t i)
+{
+    struct lru_cache_entry *e = lru_cache_get_entry(s, i);
+    uint32_t hash;
+
+    assert(e->mru == i && e->lru != LRU_CACHE_ENTRY_NIL && e->lru > 0);
+
+    if (--e->lru > 0) {
+        return;
+    }
+
+    s->pinned--;
+    hash = bucket(s, e->key);
+
+    if (in_chain(s, i, hash)) {
+        insert_as_mru(s, i, e);
+        return;
+    }
+
+    // Flushed while pinned, release it now
+    if (s->destroy) {
+        s->destroy(e->key, i);
+    }
+
+    e->clru = i;
+    e->cmru = LRU_CACHE_ENTRY_NIL;
+    insert_as_lru(s, i, e);
+}
+
+void lru_cache_flush(struct lru_cache *s)
+{
+    lru_cache_flush_lazy(s);
+    lru_cache_drain_flush(s, UINT32_MAX);
+    lru_cache_drain_evictions(s, UINT32_MAX);
+}
+
+void lru_cache_flush_lazy(struct lru_cache *s)
+{
+    /*
+     * Used entries always form a contiguous segment at the MRU end of the global chain, because
+     * lru_cache_put takes its slots from the LRU end. Remembering the current MRU entry is therefore
+     * enough to mark every used entry as stale:
+     *
+     *   LRU -> [free entries] [stale entries] [entries inserted after the flush] -> MRU
+     *
+     * Lookups cannot reach stale entries once the hashmap is cleared, so they never move again and
+     * are consumed from the LRU end by lru_cache_put, or released by lru_cache_drain_flush.
+     */
+    struct lru_cache_entry *e = lru_cache_get_entry(s, s->mru);
+    uint32_t i;
+
+    if (s->nmemb == 0) {
+        return;
+    }
+
+    if (e->clru != s->mru) {
+        s->stale = s->mru;
+    }
+
+    /*
+     * Entries being loaded or pinned keep their slot until lru_cache_load_end or the last unpin, but
+     * must leave their chain, or a later rebuild of the hashmap would make them reachable again.
+     */
+    for (i = 0; has_detached(s) && i < s->nmemb; i++) {
+        if (is_detached((e = lru_cache_get_entry(s, i)), i)) {
+            e->clru = i;
+            e->cmru = LRU_CACHE_ENTRY_NIL;
+        }
+    }
+
+    memset(s->hashmap, 0xff, s->nbuckets * sizeof(*s->hashmap));
+    memset(lru_cache_get_tags(s->hashmap, s->nbuckets), 0, s->nbuckets * sizeof(uint16_t));
+}
+
+uint32_t lru_cache_drain_flush(struct lru_cache *s, uint32_t budget)
+{
+    uint32_t n;
+    uint32_t i;
+    struct lru_cache_entry *e;
+    struct lru_cache_entry *next;
+
+    for (n = 0; n < budget && s->stale != LRU_CACHE_ENTRY_NIL; n++) {
+        i = s->stale;
+        e = lru_cache_get_entry(s, i);
+        next = lru_cache_get_entry(s, e->lru);
+
+        s->stale = (next && next->clru != e->lru) ? e->lru : LRU_CACHE_ENTRY_NIL;
+
+        if (s->destroy) {
+            s->destroy(e->key, i);
+        }
+
+        e->clru = i;
+        e->cmru = LRU_CACHE_ENTRY_NIL;
+
+        // Keep free entries at the LRU end
+        if (s->lru != i) {
+            remove_from_global_chain(s, e);
+            insert_as_lru(s, i, e);
+        }
+    }
+
+    return n;
 }
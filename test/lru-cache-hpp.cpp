@@ -0,0 +1,139 @@
+#include "lru-cache.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define TEST(NAME) \
+    { \
+        fprintf(stderr, "%s\n", #NAME); \
+        NAME(); \
+        fprintf(stderr, "\r\033[A%s \033[32;1mOK\033[0m\n", #NAME); \
+    }
+
+static int alive;
+
+struct counted {
+    int value;
+
+    explicit counted(int v) : value(v) { alive++; }
+    counted(counted &&other) noexcept : value(other.value) { alive++; }
+    counted &operator=(counted &&other) noexcept { value = other.value; return *this; }
+    ~counted() { alive--; }
+};
+
+struct hash_to_zero {
+    std::size_t operator()(const std::string &) const { return 0; }
+};
+
+static int hashes;
+static int compares;
+
+struct counting_hash {
+    std::size_t operator()(int k) const { return hashes++, static_cast<std::size_t>(k); }
+};
+
+struct counting_eq {
+    bool operator()(int a, int b) const { return compares++, a == b; }
+};
+
+static void test_cpp_cache_strings(void)
+{
+    std::vector<std::string> order;
+
+    {
+        lru::cache<std::string, counted, std::hash<std::string>, std::equal_to<std::string>, 2> c;
+
+        assert(c.find("a") == nullptr);
+        assert(c.insert("a", counted(1)).second);
+        assert(c.insert("a long key that does not fit into small string storage", counted(2)).second);
+        assert(alive == 2 && c.full());
+
+        // Present keys keep their value
+        assert(!c.insert("a", counted(3)).second);
+        assert(c.find("a")->value == 1 && alive == 2);
+
+        // Evicts the long key
+        assert(c.insert("c", counted(4)).second);
+        assert(alive == 2);
+        assert(c.find("a long key that does not fit into small string storage") == nullptr);
+
+        assert(!c.insert_or_assign("a", counted(5)).second);
+        assert(c.find("a")->value == 5);
+
+        c.for_each([&](const std::string &k, counted &) { order.push_back(k); });
+        assert((order == std::vector<std::string>{ "a", "c" }));
+
+        lru::cache<std::string, counted, std::hash<std::string>, std::equal_to<std::string>, 2> d(std::move(c));
+        assert(alive == 2 && d.find("c")->value == 4);
+    }
+
+    assert(alive == 0);
+}
+
+static void test_cpp_cache_collisions(void)
+{
+    {
+        lru::cache<std::string, std::unique_ptr<int>, hash_to_zero, std::equal_to<std::string>, 3> c;
+
+        for (int i = 0; i < 8; i++) {
+            c.insert(std::to_string(i), std::make_unique<int>(i));
+        }
+
+        assert(c.find("4") == nullptr);
+        assert(**c.find("5") == 5 && **c.find("6") == 6 && **c.find("7") == 7);
+
+        c.clear();
+        assert(c.find("7") == nullptr && !c.full());
+    }
+}
+
+static void test_cpp_static_cache(void)
+{
+    static lru::static_cache<std::uint64_t, counted, std::hash<std::uint64_t>, std::equal_to<std::uint64_t>, 64> c;
+
+    for (std::uint64_t i = 0; i < 100; i++) {
+        c.insert(i, counted(static_cast<int>(i)));
+    }
+
+    assert(alive == 64);
+    assert(c.find(35) == nullptr && c.find(36)->value == 36);
+
+    c.clear();
+    assert(alive == 0);
+}
+
+static void test_cpp_cache_inline_lookup(void)
+{
+    lru::cache<int, int, counting_hash, counting_eq, 4> c;
+
+    for (int k = 0; k < 4; k++) {
+        c.insert(k, k * 10);
+    }
+
+    // One hash per lookup, one comparison per key in the chain, none on a miss the tags reject
+    hashes = compares = 0;
+
+    for (int k = 0; k < 4; k++) {
+        assert(*c.find(k) == k * 10);
+    }
+
+    assert(c.find(6) == nullptr);
+    assert(hashes == 5 && compares == 4);
+
+    // An eviction also hashes the victim, to unlink it from its bucket
+    hashes = compares = 0;
+    assert(c.insert(4, 40).second && c.find(0) == nullptr);
+    assert(hashes == 3);
+}
+
+int main(void)
+{
+    TEST(test_cpp_cache_strings);
+    TEST(test_cpp_cache_collisions);
+    TEST(test_cpp_static_cache);
+    TEST(test_cpp_cache_inline_lookup);
+}
@@ -0,0 +1,269 @@
+#include "../tools/lru-cache-server.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define TEST(NAME) \
+    { \
+        fprintf(stderr, "%s\n", #NAME); \
+        NAME(); \
+        fprintf(stderr, "\r\033[A%s \033[32;1mOK\033[0m\n", #NAME); \
+    }
+
+#define VALUE_MAX 65536
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+static char dir[] = "/tmp/lru-cache-server-XXXXXX";
+static char path[sizeof(dir) + 2];
+static pid_t server;
+static int fd = -1;
+
+// Requests are collected here and written at once, so the server reads them as one batch
+static char out[2 * VALUE_MAX];
+static size_t out_len;
+
+static char big[VALUE_MAX];
+static char in[VALUE_MAX];
+
+static void request(uint8_t op, const char *key, const void *value, uint32_t vlen, uint32_t opaque)
+{
+    struct lru_cache_server_request rq = { .op = op, .klen = (uint8_t)strlen(key), .vlen = vlen, .opaque = opaque };
+
+    assert(out_len + sizeof(rq) + rq.klen + vlen <= sizeof(out));
+
+    memcpy(out + out_len, &rq, sizeof(rq));
+    memcpy(out + out_len + sizeof(rq), key, rq.klen);
+    memcpy(out + out_len + sizeof(rq) + rq.klen, value, vlen);
+    out_len += sizeof(rq) + rq.klen + vlen;
+}
+
+static void send_all(void)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < out_len) {
+        assert((n = write(fd, out + off, out_len - off)) > 0);
+        off += n;
+    }
+
+    out_len = 0;
+}
+
+static void read_all(void *data, size_t len)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < len) {
+        assert((n = read(fd, (char *)data + off, len - off)) > 0);
+        off += n;
+    }
+}
+
+static void expect(uint8_t status, uint32_t opaque, const void *value, uint32_t vlen)
+{
+    struct lru_cache_server_response rp;
+
+    read_all(&rp, sizeof(rp));
+
+    assert(rp.status == status && rp.opaque == opaque && rp.vlen == vlen);
+
+    read_all(in, rp.vlen);
+    assert(memcmp(in, value, vlen) == 0);
+}
+
+static void reconnect(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct timespec ts = { 0, 10000000 };
+    int k;
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.0", path);
+
+    // The server may still be starting
+    for (k = 0; k < 500; k++) {
+        assert((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0);
+
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            return;
+        }
+
+        close(fd);
+        nanosleep(&ts, NULL);
+    }
+
+    assert(!"server did not start");
+}
+
+static void test_server_pipelining(void)
+{
+    reconnect();
+
+    request(LRU_CACHE_SERVER_SET, "a", "one", 3, 1);
+    request(LRU_CACHE_SERVER_GET, "a", "", 0, 2);
+    request(LRU_CACHE_SERVER_GET, "b", "", 0, 3);
+    request(LRU_CACHE_SERVER_SET, "b", "two", 3, 4);
+    request(LRU_CACHE_SERVER_GET, "b", "", 0, 5);
+    request(LRU_CACHE_SERVER_GET, "a", "", 0, 6);
+    send_all();
+
+    expect(LRU_CACHE_SERVER_OK, 1, "", 0);
+    expect(LRU_CACHE_SERVER_OK, 2, "one", 3);
+    expect(LRU_CACHE_SERVER_NOT_FOUND, 3, "", 0);
+    expect(LRU_CACHE_SERVER_OK, 4, "", 0);
+    expect(LRU_CACHE_SERVER_OK, 5, "two", 3);
+    expect(LRU_CACHE_SERVER_OK, 6, "one", 3);
+
+    // a request split across writes is handled once complete
+    request(LRU_CACHE_SERVER_GET, "b", "", 0, 7);
+    assert(write(fd, out, 5) == 5);
+    memmove(out, out + 5, out_len - 5);
+    out_len -= 5;
+    send_all();
+
+    expect(LRU_CACHE_SERVER_OK, 7, "two", 3);
+}
+
+static void test_server_set_pinned(void)
+{
+    reconnect();
+
+    request(LRU_CACHE_SERVER_SET, "p", "old", 3, 1);
+    send_all();
+    expect(LRU_CACHE_SERVER_OK, 1, "", 0);
+
+    // the get pins the slab value it responds with, so the set in the same batch must not change it
+    request(LRU_CACHE_SERVER_GET, "p", "", 0, 2);
+    request(LRU_CACHE_SERVER_SET, "p", "new!", 4, 3);
+    request(LRU_CACHE_SERVER_GET, "p", "", 0, 4);
+    request(LRU_CACHE_SERVER_SET, "p", "last", 4, 5);
+    send_all();
+
+    expect(LRU_CACHE_SERVER_OK, 2, "old", 3);
+    expect(LRU_CACHE_SERVER_OK, 3, "", 0);
+    expect(LRU_CACHE_SERVER_OK, 4, "new!", 4);
+    expect(LRU_CACHE_SERVER_OK, 5, "", 0);
+
+    request(LRU_CACHE_SERVER_GET, "p", "", 0, 6);
+    send_all();
+    expect(LRU_CACHE_SERVER_OK, 6, "last", 4);
+}
+
+static void test_server_pending(void)
+{
+    uint32_t k;
+
+    reconnect();
+
+    memset(big, 'x', sizeof(big));
+    request(LRU_CACHE_SERVER_SET, "big", big, sizeof(big), 0);
+    send_all();
+    expect(LRU_CACHE_SERVER_OK, 0, "", 0);
+
+    // Megabytes of responses without reading, far more than the socket buffers: the writev is
+    // partial and the rest, copied to the pending buffer, outlives the pins of its batch
+    for (k = 1; k <= 64; k++) {
+        request(LRU_CACHE_SERVER_GET, "big", "", 0, k);
+    }
+
+    send_all();
+
+    // responses to later batches must not overtake the pending ones, nor the set change them
+    memset(big, 'y', sizeof(big));
+    request(LRU_CACHE_SERVER_SET, "big", big, 1, 65);
+    request(LRU_CACHE_SERVER_GET, "big", "", 0, 66);
+    send_all();
+
+    memset(big, 'x', sizeof(big));
+
+    for (k = 1; k <= 64; k++) {
+        expect(LRU_CACHE_SERVER_OK, k, big, sizeof(big));
+    }
+
+    expect(LRU_CACHE_SERVER_OK, 65, "", 0);
+    expect(LRU_CACHE_SERVER_OK, 66, "y", 1);
+}
+
+static void test_server_delete(void)
+{
+    reconnect();
+
+    request(LRU_CACHE_SERVER_DELETE, "d", "", 0, 1);
+    request(LRU_CACHE_SERVER_SET, "d", "value", 5, 2);
+    request(LRU_CACHE_SERVER_DELETE, "d", "", 0, 3);
+    send_all();
+
+    expect(LRU_CACHE_SERVER_NOT_FOUND, 1, "", 0);
+    expect(LRU_CACHE_SERVER_OK, 2, "", 0);
+    expect(LRU_CACHE_SERVER_OK, 3, "", 0);
+
+    // the entry stays cached as a tombstone, which reads as missing until set again
+    request(LRU_CACHE_SERVER_GET, "d", "", 0, 4);
+    request(LRU_CACHE_SERVER_DELETE, "d", "", 0, 5);
+    request(LRU_CACHE_SERVER_SET, "d", "again", 5, 6);
+    request(LRU_CACHE_SERVER_GET, "d", "", 0, 7);
+    send_all();
+
+    expect(LRU_CACHE_SERVER_NOT_FOUND, 4, "", 0);
+    expect(LRU_CACHE_SERVER_NOT_FOUND, 5, "", 0);
+    expect(LRU_CACHE_SERVER_OK, 6, "", 0);
+    expect(LRU_CACHE_SERVER_OK, 7, "again", 5);
+}
+
+static void test_server_malformed(void)
+{
+    struct lru_cache_server_request rq = { .op = LRU_CACHE_SERVER_GET, .klen = 1, .reserved = 1 };
+    char c;
+
+    reconnect();
+
+    assert(write(fd, &rq, sizeof(rq)) == sizeof(rq) && write(fd, "a", 1) == 1);
+    assert(read(fd, &c, 1) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *exe = (argc > 1) ? argv[1] : "tools/lru-cache-server";
+    int status;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    assert(mkdtemp(dir) != NULL);
+    snprintf(path, sizeof(path), "%s/s", dir);
+
+    if ((server = fork()) == 0) {
+        execl(exe, exe, "-j", "1", "-n", "64", "-v", XSTR(VALUE_MAX), path, (char *)NULL);
+        perror(exe);
+        _exit(127);
+    }
+
+    assert(server > 0);
+
+    TEST(test_server_pipelining);
+    TEST(test_server_set_pinned);
+    TEST(test_server_pending);
+    TEST(test_server_delete);
+    TEST(test_server_malformed);
+
+    close(fd);
+
+    assert(kill(server, SIGTERM) == 0 && waitpid(server, &status, 0) == server);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(rmdir(dir) == 0);
+    return 0;
+}
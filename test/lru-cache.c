@@ -1,17 +1,48 @@
 #include "lru-cache.h"
+#include "lru-cache-trace.h"
+#include "lru-cache-mrc.h"
+#include "lru-cache-autosize.h"
+#include "lru-cache-tier.h"
+#include "lru-cache-access.h"
+#include "lru-cache-lru2.h"
+#include "lru-cache-writeback.h"
+#include "../bench/perf-counters.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
+// The hardware counters of each test follow its name, to spot a test that suddenly costs more
 #define TEST(NAME) \
     { \
         fprintf(stderr, "%s\n", #NAME); \
+        perf_counters_start(&counters); \
         NAME(); \
-        fprintf(stderr, "\r\033[A%s \033[32;1mOK\033[0m\n", #NAME); \
+        perf_counters_stop(&counters); \
+        fprintf(stderr, "\r\033[A%s \033[32;1mOK\033[0m", #NAME); \
+        report(); \
     }
 
+static struct perf_counters counters;
+
+static void report(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (perf_counter_available(&counters, i)) {
+            fprintf(stderr, " %s=%llu", perf_counter_names[i], (unsigned long long)counters.value[i]);
+        }
+    }
+
+    fprintf(stderr, "\n");
+    perf_counters_clear(&counters);
+}
+
 static const char *eviction = "";
 static struct lru_cache c;
 
@@ -22,14 +53,23 @@ static void destroy(void *key, uint32_t idx)
     assert(*(char *)key == *eviction++);
 }
 
-static uint32_t hash_to_zero(const void *a_, uint32_t m_)
+static uint32_t hash_to_zero(const void *a_)
+{
+    return (void)a_, 0u;
+}
+
+static uint32_t hash_to_self(const void *a_)
 {
-    return (void)a_, (void)m_, 0u;
+    return *(char *)a_ - 'a';
 }
 
-static uint32_t hash_to_self(const void *a_, uint32_t m_)
+static int load_result;
+
+static int load(const void *key, uint32_t idx)
 {
-    return (*(char *)a_ - 'a') % m_;
+    (void)key, (void)idx;
+
+    return load_result;
 }
 
 static int my_compare(const void *a_, const void *b_)
@@ -480,17 +520,198 @@ static void test_cache_flush_full_with_collisions(void)
     free(cache);
 }
 
-static void test_cache_set_nmemb_initial_multi(void)
+static void test_cache_lazy_flush(void)
 {
+    bool put;
     size_t hashmap_bytes, cache_bytes;
     void *hashmap, *cache;
 
-    assert(lru_cache_init(&c, sizeof(char), hash_to_zero, my_compare, destroy) == 0);
+    assert(lru_cache_init(&c, sizeof(char), hash_to_self, my_compare, destroy) == 0);
 
+    eviction = "";
     assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    assert(lru_cache_get_or_put(&c, "a", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "b", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "c", &put) != LRU_CACHE_ENTRY_NIL && put);
+
+    lru_cache_flush_lazy(&c);
+    assert(!lru_cache_is_full(&c));
+
+    assert(lru_cache_get_or_put(&c, "a", NULL) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "b", NULL) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "c", NULL) == LRU_CACHE_ENTRY_NIL);
+
+    // free entries are used first, then stale entries are destroyed in LRU order
+    assert(lru_cache_get_or_put(&c, "d", &put) != LRU_CACHE_ENTRY_NIL && put);
+
+    eviction = "a";
+    assert(lru_cache_get_or_put(&c, "e", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(*eviction == 0);
+
+    eviction = "c";
+    assert(lru_cache_drain_flush(&c, 1) == 1);
+    assert(*eviction == 0);
+
+    eviction = "b";
+    assert(lru_cache_drain_flush(&c, 4) == 1);
+    assert(*eviction == 0);
+    assert(c.stale == LRU_CACHE_ENTRY_NIL);
+
+    eviction = "";
+    assert(lru_cache_get_or_put(&c, "d", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "e", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "f", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "g", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_is_full(&c));
+
+    eviction = "d";
+    assert(lru_cache_get_or_put(&c, "h", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(*eviction == 0);
+
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_lazy_flush_with_collisions(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+
+    assert(lru_cache_init(&c, sizeof(char), hash_to_zero, my_compare, destroy) == 0);
+
+    eviction = "";
     assert(lru_cache_set_nmemb(&c, 2, &hashmap_bytes, &cache_bytes) == 0);
-    assert(lru_cache_set_nmemb(&c, 1, &hashmap_bytes, &cache_bytes) == 0);
-    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    assert(lru_cache_get_or_put(&c, "a", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "b", &put) != LRU_CACHE_ENTRY_NIL && put);
+
+    lru_cache_flush_lazy(&c);
+
+    eviction = "a";
+    assert(lru_cache_get_or_put(&c, "c", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(*eviction == 0);
+
+    lru_cache_flush_lazy(&c);
+    assert(lru_cache_get_or_put(&c, "c", NULL) == LRU_CACHE_ENTRY_NIL);
+
+    eviction = "b";
+    assert(lru_cache_get_or_put(&c, "d", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(*eviction == 0);
+
+    eviction = "dc";
+    lru_cache_flush(&c);
+    assert(*eviction == 0);
+    assert(lru_cache_get_or_put(&c, "d", NULL) == LRU_CACHE_ENTRY_NIL);
+
+    eviction = "";
+    assert(lru_cache_get_or_put(&c, "a", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "b", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "a", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "b", NULL) != LRU_CACHE_ENTRY_NIL);
+
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_deferred_evictions(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    uint32_t evictions[2];
+    uint32_t a, i, n;
+    struct lru_cache_entry *e;
+
+    assert(lru_cache_init(&c, sizeof(char), hash_to_self, my_compare, destroy) == 0);
+
+    eviction = "";
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+    assert(lru_cache_set_evictions(&c, NULL, 2) == EINVAL);
+    assert(lru_cache_set_evictions(&c, evictions, 2) == 0);
+
+    assert((a = lru_cache_get_or_put(&c, "a", &put)) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "b", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "c", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "d", &put) != LRU_CACHE_ENTRY_NIL && put);
+
+    // a and b are evicted ahead, but not destroyed
+    assert(c.evictions_count == 2);
+    assert(lru_cache_get_or_put(&c, "a", NULL) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "b", NULL) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "c", NULL) != LRU_CACHE_ENTRY_NIL);
+
+    // not drained in time, the oldest pending eviction is completed inline
+    eviction = "a";
+    assert(lru_cache_get_or_put(&c, "e", &put) == a && put);
+    assert(*eviction == 0);
+    assert(c.evictions_count == 2);
+
+    eviction = "bd";
+    assert(lru_cache_drain_evictions(&c, 8) == 2);
+    assert(*eviction == 0);
+
+    // drained slots are used without eviction, then c and e are evicted ahead
+    eviction = "";
+    assert(lru_cache_get_or_put(&c, "f", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "g", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "c", NULL) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "f", NULL) != LRU_CACHE_ENTRY_NIL);
+
+    // The ring buffer costs its capacity: the full cache holds nmemb - 2 keys, drained or not
+    n = 0;
+    LRU_CACHE_ITERATE_MRU_TO_LRU(&c, i, e) {
+        n++;
+    }
+    assert(n == 2 && c.evictions_count == 2);
+
+    eviction = "ce";
+    assert(lru_cache_drain_evictions(&c, 8) == 2);
+    assert(*eviction == 0);
+    n = 0;
+    LRU_CACHE_ITERATE_MRU_TO_LRU(&c, i, e) {
+        n++;
+    }
+    assert(n == 2);
+
+    eviction = "fg";
+    lru_cache_flush(&c);
+    assert(*eviction == 0);
+    assert(c.evictions_count == 0);
+
+    assert(lru_cache_set_evictions(&c, NULL, 0) == 0);
+
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_get_or_load(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    enum lru_cache_load_state state;
+    uint32_t b, x;
+
+    assert(lru_cache_init(&c, sizeof(char), hash_to_self, my_compare, destroy) == 0);
+
+    eviction = "";
     assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
 
     hashmap = malloc(hashmap_bytes);
@@ -498,42 +719,1564 @@ static void test_cache_set_nmemb_initial_multi(void)
 
     assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
 
+    load_result = 0;
+    assert(lru_cache_get_or_load(&c, "a", load, &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_load(&c, "a", load, &put) != LRU_CACHE_ENTRY_NIL && !put);
+
+    // concurrent requesters are told to wait for the first one
+    assert((b = lru_cache_load_begin(&c, "b", &state)) != LRU_CACHE_ENTRY_NIL);
+    assert(state == LRU_CACHE_LOAD_MISS);
+    assert(lru_cache_load_begin(&c, "b", &state) == b && state == LRU_CACHE_LOAD_PENDING);
+    assert(lru_cache_get_or_load(&c, "b", load, &put) == LRU_CACHE_ENTRY_NIL);
+
+    // a shrink that would drop the entry being loaded is refused
+    assert(b == 1 && lru_cache_set_nmemb(&c, 1, &hashmap_bytes, &cache_bytes) == EBUSY);
+
+    // entries being loaded are not evicted
+    assert(lru_cache_get_or_put(&c, "c", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "d", &put) != LRU_CACHE_ENTRY_NIL && put);
+
+    eviction = "a";
+    assert(lru_cache_get_or_put(&c, "e", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(*eviction == 0);
+    assert(lru_cache_get_or_put(&c, "b", NULL) == b);
+
+    // a failed load leaves no entry behind
+    eviction = "";
+    assert(lru_cache_load_end(&c, b, false) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "b", NULL) == LRU_CACHE_ENTRY_NIL);
+
+    load_result = -1;
+    assert(lru_cache_get_or_load(&c, "b", load, &put) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "b", NULL) == LRU_CACHE_ENTRY_NIL);
+
+    load_result = 0;
+    assert(lru_cache_get_or_load(&c, "b", load, &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "b", NULL) != LRU_CACHE_ENTRY_NIL);
+
+    // a load completing after a flush is not published
+    eviction = "c";
+    assert((x = lru_cache_load_begin(&c, "x", &state)) != LRU_CACHE_ENTRY_NIL);
+    assert(state == LRU_CACHE_LOAD_MISS && *eviction == 0);
+
+    eviction = "bed";
+    lru_cache_flush(&c);
+    assert(*eviction == 0);
+
+    eviction = "x";
+    assert(lru_cache_load_end(&c, x, true) == LRU_CACHE_ENTRY_NIL);
+    assert(*eviction == 0);
+    assert(lru_cache_get_or_put(&c, "x", NULL) == LRU_CACHE_ENTRY_NIL);
+
+    eviction = "";
+    assert(lru_cache_set_nmemb(&c, 2, &hashmap_bytes, &cache_bytes) == 0);
+
     free(hashmap);
     free(cache);
 }
 
-static void test_cache_set_nmemb_multi(void)
+static void test_cache_trace(void)
 {
+    bool put;
     size_t hashmap_bytes, cache_bytes;
     void *hashmap, *cache;
+    char path[] = "/tmp/lru-cache-trace-XXXXXX";
+    char magic[sizeof(LRU_CACHE_TRACE_MAGIC) - 1];
+    struct lru_cache_trace_record r[4];
+    struct lru_cache_trace t, u;
+    FILE *f;
+    int fd;
 
-    assert(lru_cache_init(&c, sizeof(char), hash_to_zero, my_compare, destroy) == 0);
+    assert(lru_cache_init(&c, sizeof(char), hash_to_self, my_compare, destroy) == 0);
 
-    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+    eviction = "";
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
 
     hashmap = malloc(hashmap_bytes);
     cache = malloc(cache_bytes);
 
     assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
 
+    assert((fd = mkstemp(path)) >= 0);
+    close(fd);
+
+    assert(lru_cache_trace_open(&t, path) == 0);
+    assert(lru_cache_trace_open(&u, "/dev/null") == 0);
+    c.trace = lru_cache_trace_record;
+    c.trace_arg = &t;
+
+    assert(lru_cache_get_or_put(&c, "a", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "a", NULL) != LRU_CACHE_ENTRY_NIL);
+
+    // records for another trace write out the buffered ones of the first
+    lru_cache_trace_record(&u, "z", 0, false);
+    assert(lru_cache_trace_close(&u) == 0);
+    assert(lru_cache_trace_flush(&u) == EBADF);
+
+    assert(lru_cache_get_or_put(&c, "b", NULL) == LRU_CACHE_ENTRY_NIL);
+
+    assert(lru_cache_trace_close(&t) == 0);
+    assert(lru_cache_trace_close(&t) == EBADF);
+    c.trace = NULL;
+    c.trace_arg = NULL;
+
+    assert((f = fopen(path, "rb")) != NULL);
+    assert(fread(magic, sizeof(magic), 1, f) == 1);
+    assert(fread(r, sizeof(r[0]), 4, f) == 3);
+    fclose(f);
+    unlink(path);
+
+    assert(r[0].hash == lru_cache_hash(&c, "a") && !LRU_CACHE_TRACE_HIT(&r[0]));
+    assert(r[1].hash == r[0].hash && LRU_CACHE_TRACE_HIT(&r[1]));
+    assert(r[2].hash == lru_cache_hash(&c, "b") && !LRU_CACHE_TRACE_HIT(&r[2]));
+    assert(LRU_CACHE_TRACE_TIME(&r[0]) <= LRU_CACHE_TRACE_TIME(&r[1]));
+    assert(LRU_CACHE_TRACE_TIME(&r[1]) <= LRU_CACHE_TRACE_TIME(&r[2]));
+
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_mrc(void)
+{
+    int i;
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    struct lru_cache_mrc m;
+
+    assert(lru_cache_init(&c, sizeof(char), hash_to_self, my_compare, NULL) == 0);
     assert(lru_cache_set_nmemb(&c, 16, &hashmap_bytes, &cache_bytes) == 0);
-    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
-    assert(lru_cache_set_nmemb(&c, 7, &hashmap_bytes, &cache_bytes) == 0);
-    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
-    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
-    assert(lru_cache_set_nmemb(&c, 5, &hashmap_bytes, &cache_bytes) == 0);
 
-    hashmap = realloc(hashmap, hashmap_bytes);
-    cache = realloc(cache, cache_bytes);
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
 
     assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
 
+    assert(lru_cache_mrc_init(&m, 0.0, 4) == EINVAL);
+    assert(lru_cache_mrc_init(&m, 1.0, 0) == EINVAL);
+
+    // cycling through 4 keys hits from a capacity of 4 on, with renumbering every 8 accesses
+    assert(lru_cache_mrc_init(&m, 1.0, 4) == 0);
+
+    c.trace = lru_cache_mrc_access;
+    c.trace_arg = &m;
+
+    for (i = 0; i < 10; i++) {
+        assert(lru_cache_get_or_put(&c, "a", &put) != LRU_CACHE_ENTRY_NIL);
+        assert(lru_cache_get_or_put(&c, "b", &put) != LRU_CACHE_ENTRY_NIL);
+        assert(lru_cache_get_or_put(&c, "c", &put) != LRU_CACHE_ENTRY_NIL);
+        assert(lru_cache_get_or_put(&c, "d", &put) != LRU_CACHE_ENTRY_NIL);
+    }
+
+    assert(m.samples == 40 && m.cold == 4);
+    assert(lru_cache_mrc_hit_ratio(&m, 3) == 0.0);
+    assert(lru_cache_mrc_hit_ratio(&m, 4) == 0.9);
+    assert(lru_cache_mrc_hit_ratio(&m, 1000) == 0.9);
+
+    lru_cache_mrc_free(&m);
+
+    // distances beyond the tracked keys are misses
+    assert(lru_cache_mrc_init(&m, 1.0, 3) == 0);
+
+    for (i = 0; i < 10; i++) {
+        assert(lru_cache_get_or_put(&c, "a", &put) != LRU_CACHE_ENTRY_NIL);
+        assert(lru_cache_get_or_put(&c, "b", &put) != LRU_CACHE_ENTRY_NIL);
+        assert(lru_cache_get_or_put(&c, "c", &put) != LRU_CACHE_ENTRY_NIL);
+        assert(lru_cache_get_or_put(&c, "d", &put) != LRU_CACHE_ENTRY_NIL);
+    }
+
+    assert(m.samples == 40 && m.cold == 40);
+    assert(lru_cache_mrc_hit_ratio(&m, 4) == 0.0);
+
+    lru_cache_mrc_free(&m);
+    c.trace = NULL;
+
     free(hashmap);
     free(cache);
 }
 
-int main()
+static void write_file(const char *path, const char *content)
+{
+    FILE *f = fopen(path, "w");
+
+    assert(f != NULL);
+    assert(fputs(content, f) >= 0);
+    assert(fclose(f) == 0);
+}
+
+static void test_cache_autosize(void)
 {
+    bool put;
+    char psi[] = "/tmp/lru-cache-psi-XXXXXX";
+    struct lru_cache_autosize a;
+    struct lru_cache_mrc m;
+    int fd;
+
+    assert((fd = mkstemp(psi)) >= 0);
+    close(fd);
+
+    write_file(psi, "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+
+    assert(lru_cache_init(&c, sizeof(char), hash_to_self, my_compare, NULL) == 0);
+
+    // a hook set before is still called
+    assert(lru_cache_mrc_init(&m, 1.0, 16) == 0);
+    c.trace = lru_cache_mrc_access;
+    c.trace_arg = &m;
+
+    assert(lru_cache_autosize_init(&a, &c, 4) == 0);
+    assert(c.nmemb == 4);
+
+    a.max_nmemb = 12;
+    a.step = 4;
+    a.psi_path = psi;
+
+    // initial hit ratio of 0.5 on a full cache
+    assert(lru_cache_get_or_put(&c, "a", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "b", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "c", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "d", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "a", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "b", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "c", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "d", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(m.samples == 8 && m.cold == 4);
+
+    assert(lru_cache_autosize_step(&a) == 0);
+    assert(c.nmemb == 8);
+
+    // growing improved the hit ratio, so keep growing
+    assert(lru_cache_get_or_put(&c, "e", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "a", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "b", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "c", NULL) != LRU_CACHE_ENTRY_NIL);
+
+    assert(lru_cache_autosize_step(&a) == 0);
+    assert(c.nmemb == 12);
+
+    // no further improvement
+    assert(lru_cache_get_or_put(&c, "f", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "a", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "b", NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, "c", NULL) != LRU_CACHE_ENTRY_NIL);
+
+    assert(lru_cache_autosize_step(&a) == 0);
+    assert(c.nmemb == 12 && !a.growing);
+
+    // memory pressure shrinks down to the minimum, with hysteresis
+    write_file(psi, "some avg10=50.00 avg60=0.00 avg300=0.00 total=0\n");
+
+    assert(lru_cache_autosize_step(&a) == 0);
+    assert(c.nmemb == 8 && a.pressure);
+
+    write_file(psi, "some avg10=5.00 avg60=0.00 avg300=0.00 total=0\n");
+
+    assert(lru_cache_autosize_step(&a) == 0);
+    assert(c.nmemb == 4 && a.pressure);
+
+    assert(lru_cache_autosize_step(&a) == 0);
+    assert(c.nmemb == 4 && a.pressure);
+
+    write_file(psi, "some avg10=0.50 avg60=0.00 avg300=0.00 total=0\n");
+
+    assert(lru_cache_autosize_step(&a) == 0);
+    assert(c.nmemb == 4 && !a.pressure);
+
+    assert(lru_cache_get_or_put(&c, "g", &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(lru_cache_get_or_put(&c, "g", NULL) != LRU_CACHE_ENTRY_NIL);
+
+    // a replaced hook no longer counts hits
+    c.trace = lru_cache_mrc_access;
+    c.trace_arg = &m;
+    assert(lru_cache_autosize_step(&a) == EBUSY);
+    c.trace = NULL;
+
+    lru_cache_mrc_free(&m);
+    lru_cache_autosize_free(&a);
+    unlink(psi);
+}
+
+static void test_cache_autosize_aligned(void)
+{
+    struct lru_cache_autosize a;
+    unsigned char key[240];
+    uint32_t size, i;
+    bool put;
+
+    // Beyond the alignment of malloc, so the controller must allocate aligned memory and copy
+    assert(lru_cache_align(100, 256, &size) == 0 && size == 240);
+    assert(lru_cache_init(&c, size, NULL, NULL, NULL) == 0);
+    assert(lru_cache_set_align(&c, 256) == 0);
+    assert(lru_cache_autosize_init(&a, &c, 4) == 0);
+
+    a.max_nmemb = 8;
+    a.step = 4;
+    a.psi_path = NULL;
+
+    for (i = 0; i < 4; i++) {
+        memset(key, 0, sizeof(key));
+        key[0] = i;
+        assert(lru_cache_get_or_put(&c, key, &put) == i && put);
+        assert((uintptr_t)lru_cache_get_entry(&c, i)->key % 256 == 0);
+    }
+
+    assert(lru_cache_autosize_step(&a) == 0);
+    assert(c.nmemb == 8);
+
+    for (i = 0; i < 8; i++) {
+        assert((uintptr_t)lru_cache_get_entry(&c, i)->key % 256 == 0);
+    }
+
+    for (i = 0; i < 4; i++) {
+        memset(key, 0, sizeof(key));
+        key[0] = i;
+        assert(lru_cache_get_or_put(&c, key, NULL) == i);
+    }
+
+    lru_cache_autosize_free(&a);
+}
+
+static void test_cache_set_nmemb_initial_multi(void)
+{
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+
+    assert(lru_cache_init(&c, sizeof(char), hash_to_zero, my_compare, destroy) == 0);
+
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_set_nmemb(&c, 2, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_set_nmemb(&c, 1, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_set_nmemb_multi(void)
+{
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+
+    assert(lru_cache_init(&c, sizeof(char), hash_to_zero, my_compare, destroy) == 0);
+
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    assert(lru_cache_set_nmemb(&c, 16, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_set_nmemb(&c, 7, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_set_nmemb(&c, 5, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = realloc(hashmap, hashmap_bytes);
+    cache = realloc(cache, cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_power_of_two_buckets(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    const char *key;
+
+    assert(lru_cache_calc_nbuckets(1, LRU_CACHE_LOAD_FACTOR_DEFAULT) == 1);
+    assert(lru_cache_calc_nbuckets(5, LRU_CACHE_LOAD_FACTOR_DEFAULT) == 8);
+    assert(lru_cache_calc_nbuckets(8, LRU_CACHE_LOAD_FACTOR_DEFAULT) == 8);
+    assert(lru_cache_calc_nbuckets(UINT32_MAX, LRU_CACHE_LOAD_FACTOR_DEFAULT) == (UINT32_C(1) << 31));
+
+    assert(lru_cache_init(&c, sizeof(char), hash_to_self, my_compare, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 3, &hashmap_bytes, &cache_bytes) == 0);
+    assert(hashmap_bytes == 4 * LRU_CACHE_BUCKET_SIZE);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    // "a" and "e" share bucket 0 of 4, but not of 8
+    for (key = "aec"; *key; key++) {
+        assert(lru_cache_get_or_put(&c, key, &put) != LRU_CACHE_ENTRY_NIL && put);
+    }
+
+    assert(lru_cache_set_nmemb(&c, 5, &hashmap_bytes, &cache_bytes) == 0);
+    assert(hashmap_bytes == 8 * LRU_CACHE_BUCKET_SIZE);
+
+    hashmap = realloc(hashmap, hashmap_bytes);
+    cache = realloc(cache, cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+    assert(c.hashmap[0] != LRU_CACHE_ENTRY_NIL && c.hashmap[4] != LRU_CACHE_ENTRY_NIL);
+
+    for (key = "aec"; *key; key++) {
+        assert(lru_cache_get_or_put(&c, key, &put) != LRU_CACHE_ENTRY_NIL && !put);
+    }
+
+    // Folds bucket 4 back into bucket 0
+    assert(lru_cache_set_nmemb(&c, 3, &hashmap_bytes, &cache_bytes) == 0);
+    assert(hashmap_bytes == 4 * LRU_CACHE_BUCKET_SIZE);
+
+    for (key = "aec"; *key; key++) {
+        assert(lru_cache_get_or_put(&c, key, NULL) != LRU_CACHE_ENTRY_NIL);
+    }
+
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_load_factor(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *old_hashmap, *cache;
+    const char *key;
+
+    assert(lru_cache_calc_nbuckets(8, 50) == 16);
+    assert(lru_cache_calc_nbuckets(6, 200) == 4);
+
+    assert(lru_cache_init(&c, sizeof(char), hash_to_self, my_compare, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+    assert(hashmap_bytes == 4 * LRU_CACHE_BUCKET_SIZE);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    for (key = "aeb"; *key; key++) {
+        assert(lru_cache_get_or_put(&c, key, &put) != LRU_CACHE_ENTRY_NIL && put);
+    }
+
+    // Only the hashmap is replaced, "a" and "e" no longer collide
+    assert(lru_cache_set_load_factor(&c, 0, &hashmap_bytes) == EINVAL);
+    assert(lru_cache_set_load_factor(&c, 25, &hashmap_bytes) == 0);
+    assert(hashmap_bytes == 16 * LRU_CACHE_BUCKET_SIZE);
+
+    old_hashmap = hashmap;
+    hashmap = malloc(hashmap_bytes);
+
+    assert(lru_cache_set_hashmap(&c, hashmap) == 0);
+    free(old_hashmap);
+
+    assert(c.nbuckets == 16);
+    assert(c.hashmap[0] != LRU_CACHE_ENTRY_NIL && c.hashmap[4] != LRU_CACHE_ENTRY_NIL);
+
+    for (key = "aeb"; *key; key++) {
+        assert(lru_cache_get_or_put(&c, key, NULL) != LRU_CACHE_ENTRY_NIL);
+    }
+
+    // Later resizes keep the load factor
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+    assert(hashmap_bytes == 32 * LRU_CACHE_BUCKET_SIZE);
+    assert(lru_cache_set_load_factor(&c, 100, NULL) == EBUSY);
+
+    hashmap = realloc(hashmap, hashmap_bytes);
+    cache = realloc(cache, cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    for (key = "aeb"; *key; key++) {
+        assert(lru_cache_get_or_put(&c, key, &put) != LRU_CACHE_ENTRY_NIL && !put);
+    }
+
+    free(hashmap);
+    free(cache);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(uint64_t));
+}
+
+static void test_cache_keyed_hash(void)
+{
+    bool put;
+    uint64_t key;
+    uint64_t seed[2] = { 0, 0 };
+    uint32_t hash, i, reseeds;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    struct lru_cache d;
+
+    assert(lru_cache_siphash13(seed, "abc", 3) == lru_cache_siphash13(seed, "abc", 3));
+    assert(lru_cache_siphash13(seed, "abc", 3) != lru_cache_siphash13(seed, "abd", 3));
+
+    assert(lru_cache_init(&c, sizeof(uint64_t), NULL, compare_u64, NULL) == 0);
+    assert(lru_cache_init(&d, sizeof(uint64_t), NULL, compare_u64, NULL) == 0);
+    assert(memcmp(c.seed, d.seed, sizeof(c.seed)) != 0);
+
+    assert(lru_cache_set_nmemb(&c, 64, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    // Any collision exceeds the bound, the entries must survive the rehashes, pinned ones too
+    c.max_chain = 0;
+
+    for (key = 0; key < 64; key++) {
+        assert(lru_cache_get_or_put(&c, &key, &put) != LRU_CACHE_ENTRY_NIL && put);
+        assert(key != 0 || lru_cache_pin(&c, c.mru) == 0);
+    }
+
+    for (key = 0; key < 64; key++) {
+        assert(lru_cache_get_or_put(&c, &key, &put) != LRU_CACHE_ENTRY_NIL && !put);
+    }
+
+    assert(c.reseeds > 0);
+
+    key = 0;
+    lru_cache_unpin(&c, lru_cache_get_or_put(&c, &key, NULL));
+    assert(c.pinned == 0);
+
+    // A hash returned on a miss stays valid for the insertion, also if the lookup reseeded
+    reseeds = c.reseeds;
+    for (key = 64; key < 128; key++) {
+        assert(lru_cache_get_hashed(&c, &key, &hash) == LRU_CACHE_ENTRY_NIL);
+        assert(hash == lru_cache_hash(&c, &key));
+        i = lru_cache_put_hashed(&c, &key, hash);
+        assert(lru_cache_get_or_put(&c, &key, NULL) == i);
+    }
+    assert(c.reseeds > reseeds);
+
+    free(hashmap);
+    free(cache);
+}
+
+struct record {
+    uint64_t key;
+    uint64_t value;
+};
+
+static uint32_t hash_record(const void *a)
+{
+    const struct record *r = a;
+    return (uint32_t)(r->key ^ (r->key >> 32));
+}
+
+static struct record *tier_lookup(struct lru_cache_tier *t, uint64_t key, bool *put, enum lru_cache_tier_hit *hit)
+{
+    struct record r = { key, 0 };
+    uint32_t i = lru_cache_tier_get_or_put(t, &r, put, hit);
+    struct lru_cache_entry *e = lru_cache_get_entry(t->hot, i);
+
+    return e ? (struct record *)e->key : NULL;
+}
+
+static void test_cache_tier(void)
+{
+    bool put;
+    char path[] = "/tmp/lru-cache-tier-XXXXXX";
+    size_t hashmap_bytes, cache_bytes, cold_cache_bytes;
+    void *hashmap, *cache, *cold_hashmap, *cold_cache;
+    uint32_t evictions[2];
+    uint64_t key;
+    int fd;
+    enum lru_cache_tier_hit hit;
+    struct record *r;
+    struct lru_cache cold;
+    struct lru_cache_tier t;
+
+    assert((fd = mkstemp(path)) >= 0);
+    close(fd);
+
+    assert(lru_cache_init(&c, sizeof(struct record), hash_record, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    assert(lru_cache_init(&cold, sizeof(struct record), hash_record, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&cold, 64, &hashmap_bytes, &cold_cache_bytes) == 0);
+
+    cold_hashmap = malloc(hashmap_bytes);
+
+    assert(lru_cache_tier_map(path, cold_cache_bytes, &cold_cache) == 0);
+    assert(lru_cache_set_memory(&cold, cold_hashmap, cold_cache) == 0);
+
+    assert(lru_cache_tier_init(&t, &c, &cold, NULL, 2) == EINVAL);
+    assert(lru_cache_tier_init(&t, &c, &cold, evictions, 2) == 0);
+
+    for (key = 0; key < 16; key++) {
+        assert((r = tier_lookup(&t, key, &put, &hit)) && put && hit == LRU_CACHE_TIER_MISS);
+        r->value = key * 10 + 1;
+    }
+
+    assert(t.demotions > 0);
+    assert(tier_lookup(&t, 15, NULL, &hit)->value == 151 && hit == LRU_CACHE_TIER_HOT);
+    assert(tier_lookup(&t, 0, NULL, &hit)->value == 1 && hit == LRU_CACHE_TIER_COLD);
+    assert(tier_lookup(&t, 100, NULL, &hit) == NULL && hit == LRU_CACHE_TIER_MISS);
+
+    for (key = 0; key < 16; key++) {
+        assert((r = tier_lookup(&t, key, &put, &hit)) && !put && r->value == key * 10 + 1);
+        assert(hit != LRU_CACHE_TIER_MISS);
+    }
+
+    // Changes made in the hot tier are written back on demotion
+    tier_lookup(&t, 3, NULL, &hit)->value = 999;
+
+    for (key = 20; key < 28; key++) {
+        assert(tier_lookup(&t, key, &put, &hit) && put);
+    }
+
+    assert(tier_lookup(&t, 3, NULL, &hit)->value == 999 && hit == LRU_CACHE_TIER_COLD);
+    assert(t.promotions > 0);
+
+    assert(lru_cache_tier_unmap(cold_cache, cold_cache_bytes) == 0);
+    unlink(path);
+
+    free(hashmap);
+    free(cache);
+    free(cold_hashmap);
+}
+
+static void test_cache_tier_evict_ahead(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes, cold_cache_bytes;
+    void *hashmap, *cache, *cold_hashmap, *cold_cache;
+    uint32_t evictions[2];
+    uint64_t key, x;
+    enum lru_cache_tier_hit hit;
+    struct record *r;
+    struct record probe = { 0, 0 };
+    struct lru_cache cold;
+    struct lru_cache_tier t;
+
+    assert(lru_cache_init(&c, sizeof(struct record), hash_record, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    // As small as the eviction ring, so every demotion batch replaces the whole cold tier
+    assert(lru_cache_init(&cold, sizeof(struct record), hash_record, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&cold, 2, &hashmap_bytes, &cold_cache_bytes) == 0);
+
+    cold_hashmap = malloc(hashmap_bytes);
+    cold_cache = malloc(cold_cache_bytes);
+
+    assert(lru_cache_set_memory(&cold, cold_hashmap, cold_cache) == 0);
+    assert(lru_cache_tier_init(&t, &c, &cold, evictions, 2) == 0);
+
+    for (key = 0; key < 8; key++) {
+        assert((r = tier_lookup(&t, key, &put, &hit)) && put);
+        r->value = key * 10 + 1;
+    }
+
+    for (x = 0, probe.key = 0; probe.key < 8; probe.key++) {
+        if (lru_cache_find(&cold, &probe) != LRU_CACHE_ENTRY_NIL && lru_cache_find(&c, &probe) == LRU_CACHE_ENTRY_NIL) {
+            x = probe.key;
+        }
+    }
+
+    // Promoting demotes the pending evictions, which must not replace the record being promoted
+    assert((r = tier_lookup(&t, x, NULL, &hit)) && hit == LRU_CACHE_TIER_COLD);
+    assert(r->key == x && r->value == x * 10 + 1);
+    r->value = 999;
+
+    // Once evicted from the hot tier, the modified record is only in the eviction ring
+    for (key = 100, probe.key = x; lru_cache_find(&c, &probe) != LRU_CACHE_ENTRY_NIL; key++) {
+        assert(tier_lookup(&t, key, &put, &hit) && put);
+    }
+
+    assert(c.evictions_count > 0);
+    assert((r = tier_lookup(&t, x, NULL, &hit)) && r->key == x && r->value == 999);
+
+    for (key = 0; key < 8; key++) {
+        if ((r = tier_lookup(&t, key, NULL, &hit)) != NULL) {
+            assert(r->key == key && r->value == ((key == x) ? 999 : key * 10 + 1));
+        }
+    }
+
+    free(hashmap);
+    free(cache);
+    free(cold_hashmap);
+    free(cold_cache);
+}
+
+static volatile bool seqlock_done;
+
+static void *seqlock_reader(void *arg)
+{
+    uint32_t seq, i;
+    uint64_t key;
+    uint64_t found = 0;
+    struct record r;
+
+    (void)arg;
+
+    for (key = 0; !seqlock_done; key = (key + 7) % 64) {
+        do {
+            seq = lru_cache_read_begin(&c);
+            i = lru_cache_find(&c, &key);
+
+            if (i != LRU_CACHE_ENTRY_NIL) {
+                memcpy(&r, lru_cache_get_entry(&c, i)->key, sizeof(r));
+            }
+        } while (lru_cache_read_retry(&c, seq));
+
+        if (i != LRU_CACHE_ENTRY_NIL) {
+            assert(r.key == key && r.value == key * 3);
+            found++;
+        }
+    }
+
+    return (void *)(uintptr_t)found;
+}
+
+static void test_cache_seqlock(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    uint32_t seq, i;
+    struct record r;
+    pthread_t readers[4];
+    void *found;
+    int n;
+
+    assert(lru_cache_init(&c, sizeof(struct record), hash_record, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 16, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    r.key = 1;
+    r.value = 3;
+    lru_cache_get_or_put(&c, &r, &put);
+
+    r.key = 2;
+    r.value = 6;
+    lru_cache_get_or_put(&c, &r, &put);
+
+    // Lookups leave the recency order alone
+    seq = lru_cache_read_begin(&c);
+    r.key = 1;
+    assert((i = lru_cache_find(&c, &r)) != LRU_CACHE_ENTRY_NIL && c.mru != i);
+    r.key = 3;
+    assert(lru_cache_find(&c, &r) == LRU_CACHE_ENTRY_NIL);
+    assert(!lru_cache_read_retry(&c, seq));
+
+    lru_cache_write_begin(&c);
+    assert(lru_cache_read_retry(&c, seq));
+    lru_cache_write_end(&c);
+
+    seqlock_done = false;
+
+    for (n = 0; n < 4; n++) {
+        assert(pthread_create(&readers[n], NULL, seqlock_reader, NULL) == 0);
+    }
+
+    // Keys cycle through four times the capacity, so entries are constantly evicted and reused
+    for (n = 0; n < 200000; n++) {
+        r.key = (n * 13) % 64;
+
+        lru_cache_write_begin(&c);
+        i = lru_cache_get_or_put(&c, &r, &put);
+        ((struct record *)lru_cache_get_entry(&c, i)->key)->value = r.key * 3;
+        lru_cache_write_end(&c);
+    }
+
+    seqlock_done = true;
+
+    for (n = 0; n < 4; n++) {
+        assert(pthread_join(readers[n], &found) == 0);
+    }
+
+    free(hashmap);
+    free(cache);
+}
+
+static struct lru_cache_access buffers;
+
+static void *access_reader(void *arg)
+{
+    uint32_t seq, i;
+    uint64_t key;
+    uint64_t dropped = 0;
+
+    (void)arg;
+
+    for (key = 0; !seqlock_done; key = (key + 5) % 64) {
+        do {
+            seq = lru_cache_read_begin(&c);
+            i = lru_cache_find(&c, &key);
+        } while (lru_cache_read_retry(&c, seq));
+
+        // The index may be stale by the time it is replayed, which must be harmless
+        if (i != LRU_CACHE_ENTRY_NIL) {
+            dropped += !lru_cache_access_record(&buffers, i);
+        }
+    }
+
+    return (void *)(uintptr_t)dropped;
+}
+
+static void test_cache_access_buffer(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    uint32_t i, j;
+    struct record r;
+    pthread_t readers[4];
+    void *dropped;
+    int n;
+
+    assert(lru_cache_init(&c, sizeof(struct record), hash_record, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 16, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+    assert(lru_cache_access_init(&buffers, &c, 1, 3) == EINVAL);
+    assert(lru_cache_access_init(&buffers, &c, 0, 2) == EINVAL);
+    assert(lru_cache_access_init(&buffers, &c, 1, 2) == 0);
+
+    for (r.key = 1; r.key <= 3; r.key++) {
+        r.value = r.key * 3;
+        lru_cache_get_or_put(&c, &r, &put);
+    }
+
+    r.key = 1;
+    i = lru_cache_find(&c, &r);
+    r.key = 2;
+    j = lru_cache_find(&c, &r);
+
+    // Recorded hits only change the recency order once they are drained, in order
+    assert(lru_cache_access_record(&buffers, i));
+    assert(lru_cache_access_record(&buffers, j));
+    assert(!lru_cache_access_record(&buffers, i));
+    assert(c.mru != i && c.mru != j);
+
+    assert(lru_cache_access_drain(&buffers, UINT32_MAX) == 2);
+    assert(c.mru == j && lru_cache_get_entry(&c, j)->lru == i);
+    assert(lru_cache_access_drain(&buffers, UINT32_MAX) == 0);
+
+    // Failed lookups are not recorded, and do not block the stripe
+    assert(!lru_cache_access_record(&buffers, LRU_CACHE_ENTRY_NIL));
+    assert(!lru_cache_access_record(&buffers, 16));
+    assert(lru_cache_access_record(&buffers, i));
+    assert(lru_cache_access_drain(&buffers, UINT32_MAX) == 1);
+    assert(c.mru == i);
+
+    // Indices that were reused or flushed in the meantime are skipped
+    assert(lru_cache_access_record(&buffers, 15));
+    lru_cache_flush(&c);
+    assert(lru_cache_access_record(&buffers, i));
+    assert(lru_cache_access_drain(&buffers, 1) == 1);
+    assert(lru_cache_access_drain(&buffers, 1) == 1);
+
+    lru_cache_access_free(&buffers);
+    assert(lru_cache_access_init(&buffers, &c, 4, 64) == 0);
+
+    seqlock_done = false;
+
+    for (n = 0; n < 4; n++) {
+        assert(pthread_create(&readers[n], NULL, access_reader, NULL) == 0);
+    }
+
+    for (n = 0; n < 100000; n++) {
+        r.key = (n * 13) % 64;
+        r.value = r.key * 3;
+
+        lru_cache_write_begin(&c);
+        lru_cache_get_or_put(&c, &r, &put);
+
+        if (n % 64 == 0) {
+            lru_cache_access_drain(&buffers, UINT32_MAX);
+        }
+
+        lru_cache_write_end(&c);
+    }
+
+    seqlock_done = true;
+
+    for (n = 0; n < 4; n++) {
+        assert(pthread_join(readers[n], &dropped) == 0);
+    }
+
+    lru_cache_access_drain(&buffers, UINT32_MAX);
+
+    // The chains still hold every entry exactly once
+    for (n = 0, i = c.lru; i != LRU_CACHE_ENTRY_NIL; i = lru_cache_get_entry(&c, i)->mru, n++) {
+        assert(n < 16);
+    }
+    assert(n == 16);
+
+    lru_cache_access_free(&buffers);
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_bulk_load(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    uint32_t i, n;
+    uint32_t hashes[10];
+    uint64_t keys[10];
+    uint64_t key;
+    struct lru_cache_entry *e;
+
+    for (n = 0; n < 10; n++) {
+        keys[n] = n + 1;
+        hashes[n] = 0;
+    }
+
+    assert(lru_cache_init(&c, sizeof(uint64_t), NULL, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+    assert(lru_cache_bulk_load(&c, keys, 10, hashes) == EINVAL);
+
+    // Only the 8 most recent keys fit, in the same order as if they were inserted one by one
+    assert(lru_cache_bulk_load(&c, keys, 10, NULL) == 0);
+    assert(lru_cache_bulk_load(&c, keys, 10, NULL) == EBUSY);
+
+    n = 10;
+    LRU_CACHE_ITERATE_MRU_TO_LRU(&c, i, e) {
+        assert(memcmp(e->key, &keys[--n], sizeof(uint64_t)) == 0);
+    }
+    assert(n == 2);
+
+    for (n = 0; n < 10; n++) {
+        assert((lru_cache_get_or_put(&c, &keys[n], NULL) != LRU_CACHE_ENTRY_NIL) == (n >= 2));
+    }
+
+    // Loading a part of the capacity leaves the rest free, to be used before anything is evicted
+    lru_cache_flush_lazy(&c);
+    assert(lru_cache_bulk_load(&c, keys, 4, NULL) == 0);
+    assert(!lru_cache_is_full(&c));
+
+    for (n = 0; n < 4; n++) {
+        assert(lru_cache_get_or_put(&c, &keys[n], NULL) != LRU_CACHE_ENTRY_NIL);
+    }
+
+    for (key = 100; key < 104; key++) {
+        lru_cache_get_or_put(&c, &key, &put);
+        assert(put);
+    }
+
+    assert(lru_cache_is_full(&c));
+    for (n = 0; n < 4; n++) {
+        assert(lru_cache_get_or_put(&c, &keys[n], NULL) != LRU_CACHE_ENTRY_NIL);
+    }
+
+    free(hashmap);
+    free(cache);
+
+    // Precomputed hashes that all collide end up in a single chain, most recent first
+    assert(lru_cache_init(&c, sizeof(uint64_t), hash_to_zero, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 16, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+    assert(lru_cache_bulk_load(&c, keys, 10, hashes) == 0);
+
+    for (n = 10, i = c.hashmap[0]; (e = lru_cache_get_entry(&c, i)); i = e->clru) {
+        assert(memcmp(e->key, &keys[--n], sizeof(uint64_t)) == 0);
+        assert(e->clru == LRU_CACHE_ENTRY_NIL || lru_cache_get_entry(&c, e->clru)->cmru == i);
+    }
+    assert(n == 0);
+
+    // Evicts the least recently loaded key first
+    for (key = 100; key < 107; key++) {
+        lru_cache_get_or_put(&c, &key, &put);
+    }
+
+    assert(lru_cache_get_or_put(&c, &keys[0], NULL) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_get_or_put(&c, &keys[1], NULL) != LRU_CACHE_ENTRY_NIL);
+
+    free(hashmap);
+    free(cache);
+}
+
+static uint32_t compares;
+
+static uint32_t hash_u32(const void *a)
+{
+    uint64_t key;
+    memcpy(&key, a, sizeof(key));
+    return (uint32_t)key;
+}
+
+static int compare_u64_counted(const void *a, const void *b)
+{
+    compares++;
+    return memcmp(a, b, sizeof(uint64_t));
+}
+
+static uint64_t key_with_tag(uint32_t low, uint32_t t)
+{
+    // The low 20 bits select the bucket, the tag is taken from a mix of all bits
+    uint64_t key = low;
+
+    while (lru_cache_tag((uint32_t)key) != (1u << t)) {
+        key += 1u << 20;
+    }
+
+    return key;
+}
+
+static void test_cache_bucket_tags(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    uint32_t n, i;
+    uint64_t key;
+    struct lru_cache_entry *e;
+
+    assert(lru_cache_init(&c, sizeof(uint64_t), hash_u32, compare_u64_counted, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    // Same bucket, tags 1 and 2
+    key = key_with_tag(0, 1);
+    lru_cache_get_or_put(&c, &key, &put);
+    key = key_with_tag(0, 2);
+    lru_cache_get_or_put(&c, &key, &put);
+
+    // A different tag in an occupied bucket is rejected without comparing
+    compares = 0;
+    key = key_with_tag(0, 3);
+    assert(lru_cache_get_or_put(&c, &key, NULL) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_find(&c, &key) == LRU_CACHE_ENTRY_NIL);
+    assert(compares == 0);
+
+    // A matching tag still walks the chain
+    key = key_with_tag(0, 1);
+    assert(lru_cache_get_or_put(&c, &key, NULL) != LRU_CACHE_ENTRY_NIL);
+    assert(compares == 2);
+
+    // Grow, split buckets and filters move along with the chain heads
+    assert(lru_cache_set_nmemb(&c, 16, &hashmap_bytes, &cache_bytes) == 0);
+    hashmap = realloc(hashmap, hashmap_bytes);
+    cache = realloc(cache, cache_bytes);
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    for (n = 0; n < 16; n++) {
+        key = key_with_tag(n, n);
+        lru_cache_get_or_put(&c, &key, &put);
+    }
+
+    compares = 0;
+    for (n = 0; n < 16; n++) {
+        key = key_with_tag(n, n);
+        assert(lru_cache_get_or_put(&c, &key, NULL) != LRU_CACHE_ENTRY_NIL);
+        key = key_with_tag(n, n ^ 8);
+        assert(lru_cache_get_or_put(&c, &key, NULL) == LRU_CACHE_ENTRY_NIL);
+    }
+    assert(compares == 16);
+
+    // Shrink, folded buckets merge their filters
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+    hashmap = realloc(hashmap, hashmap_bytes);
+    cache = realloc(cache, cache_bytes);
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    n = 0;
+    LRU_CACHE_ITERATE_MRU_TO_LRU(&c, i, e) {
+        assert(lru_cache_find(&c, e->key) == i);
+        n++;
+    }
+    assert(n == 8);
+
+    // Chains emptied by eviction drop their tags, here all but the one of bucket 0
+    for (n = 0; n < 8; n++) {
+        key = 0x100 * (n + 1);
+        lru_cache_get_or_put(&c, &key, &put);
+    }
+
+    compares = 0;
+    for (n = 0; n < 16; n++) {
+        key = key_with_tag(n, n);
+        assert((n & 7) == 0 || lru_cache_get_or_put(&c, &key, NULL) == LRU_CACHE_ENTRY_NIL);
+    }
+    assert(compares == 0);
+
+    // An entry rekeyed in place and moved to another bucket is found there
+    key = 0x100;
+    i = lru_cache_get_or_put(&c, &key, NULL);
+    e = lru_cache_get_entry(&c, i);
+    key = key_with_tag(1, 5);
+    memcpy(e->key, &key, sizeof(key));
+    lru_cache_update_entry(&c, i, e, 0x100 & (c.nbuckets - 1), 1 & (c.nbuckets - 1));
+    assert(lru_cache_get_or_put(&c, &key, NULL) == i);
+
+    free(hashmap);
+    free(cache);
+}
+
+static uint32_t destroyed;
+
+static void destroy_count(void *key, uint32_t idx)
+{
+    (void)key;
+    (void)idx;
+
+    destroyed++;
+}
+
+static void test_cache_pin(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    uint32_t b, i;
+    uint64_t key;
+    uint64_t keys[4] = { 5, 6, 7, 8 };
+
+    assert(lru_cache_init(&c, sizeof(uint64_t), hash_u32, compare_u64, destroy_count) == 0);
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+    assert(lru_cache_pin(&c, 0) == EINVAL);
+    assert(lru_cache_pin(&c, 4) == EINVAL);
+
+    for (key = 1; key <= 4; key++) {
+        lru_cache_get_or_put(&c, &key, &put);
+    }
+
+    key = 2;
+    b = lru_cache_get_or_put(&c, &key, NULL);
+
+    // Pinned entries survive any number of insertions
+    assert(lru_cache_pin(&c, b) == 0);
+    assert(lru_cache_pin(&c, b) == 0);
+
+    destroyed = 0;
+    for (key = 10; key < 20; key++) {
+        lru_cache_get_or_put(&c, &key, &put);
+    }
+    assert(destroyed == 10);
+
+    key = 2;
+    assert(lru_cache_get_or_put(&c, &key, NULL) == b);
+    assert(lru_cache_find(&c, &key) == b);
+    assert(c.mru != b && c.lru != b);
+
+    // No more than half of the entries may be pinned
+    key = 19;
+    i = lru_cache_get_or_put(&c, &key, NULL);
+    assert(lru_cache_pin(&c, i) == 0);
+    key = 18;
+    assert(lru_cache_pin(&c, lru_cache_get_or_put(&c, &key, NULL)) == EBUSY);
+
+    // Resizes and rehashes keep pinned entries where they are, and reachable
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+    hashmap = realloc(hashmap, hashmap_bytes);
+    cache = realloc(cache, cache_bytes);
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    key = 2;
+    assert(lru_cache_get_or_put(&c, &key, NULL) == b);
+    key = 19;
+    assert(lru_cache_find(&c, &key) == i);
+
+    assert(lru_cache_set_load_factor(&c, 25, &hashmap_bytes) == 0);
+    hashmap = realloc(hashmap, hashmap_bytes);
+    assert(lru_cache_set_hashmap(&c, hashmap) == 0);
+
+    key = 2;
+    assert(lru_cache_find(&c, &key) == b);
+    key = 19;
+    assert(lru_cache_get_or_put(&c, &key, NULL) == i);
+
+    // A shrink is only refused while it would drop a pinned entry
+    assert(b < 4 && i < 4);
+    assert(lru_cache_set_nmemb(&c, 1, &hashmap_bytes, &cache_bytes) == EBUSY);
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+    hashmap = realloc(hashmap, hashmap_bytes);
+    cache = realloc(cache, cache_bytes);
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    key = 2;
+    assert(lru_cache_find(&c, &key) == b);
+    key = 19;
+    assert(lru_cache_get_or_put(&c, &key, NULL) == i);
+
+    // The last pin makes the entry the most recently used one
+    lru_cache_unpin(&c, i);
+    lru_cache_unpin(&c, b);
+    assert(c.mru != b);
+    lru_cache_unpin(&c, b);
+    assert(c.mru == b);
+    assert(c.pinned == 0);
+
+    // Flushed while pinned, the entry is destroyed when released
+    assert(lru_cache_pin(&c, b) == 0);
+    destroyed = 0;
+    lru_cache_flush(&c);
+    assert(destroyed == 3);
+
+    key = 2;
+    assert(lru_cache_get_or_put(&c, &key, NULL) == LRU_CACHE_ENTRY_NIL);
+    assert(lru_cache_pin(&c, b) == 0);
+    lru_cache_unpin(&c, b);
+    assert(destroyed == 3);
+    lru_cache_unpin(&c, b);
+    assert(destroyed == 4);
+    assert(lru_cache_get_entry(&c, b)->clru == b);
+
+    for (key = 1; key <= 4; key++) {
+        lru_cache_get_or_put(&c, &key, &put);
+        assert(put);
+    }
+
+    // Nothing would be left to evict
+    c.pin_limit = 100;
+    for (key = 1; key <= 3; key++) {
+        assert(lru_cache_pin(&c, lru_cache_get_or_put(&c, &key, NULL)) == 0);
+    }
+
+    key = 4;
+    assert(lru_cache_pin(&c, lru_cache_get_or_put(&c, &key, NULL)) == EBUSY);
+
+    for (key = 1; key <= 3; key++) {
+        lru_cache_unpin(&c, lru_cache_get_or_put(&c, &key, NULL));
+    }
+
+    // A bulk load skips the slot of an entry flushed while pinned
+    key = 1;
+    b = lru_cache_get_or_put(&c, &key, NULL);
+    assert(lru_cache_pin(&c, b) == 0);
+    assert(lru_cache_bulk_load(&c, keys, 4, NULL) == EBUSY);
+
+    lru_cache_flush(&c);
+    assert(lru_cache_bulk_load(&c, keys, 4, NULL) == 0);
+
+    for (i = 0; i < 4; i++) {
+        assert(lru_cache_get_or_put(&c, &keys[i], NULL) != b);
+        assert((i == 0) == (lru_cache_find(&c, &keys[i]) == LRU_CACHE_ENTRY_NIL));
+    }
+
+    destroyed = 0;
+    lru_cache_unpin(&c, b);
+    assert(destroyed == 1 && c.lru == b);
+
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_lru2(void)
+{
+    bool put;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    uint32_t i;
+    uint64_t key;
+    struct lru_cache_lru2 k;
+
+    assert(lru_cache_init(&c, sizeof(uint64_t), hash_u32, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 4, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    // Cached before the policy is attached, ranked by recency
+    for (key = 1; key <= 2; key++) {
+        lru_cache_get_or_put(&c, &key, &put);
+    }
+
+    assert(lru_cache_lru2_init(&k, &c, 12) == EINVAL);
+    assert(lru_cache_lru2_init(&k, &c, 16) == 0);
+
+    for (key = 1; key <= 2; key++) {
+        assert(lru_cache_lru2_get_or_put(&k, &key, &put) != LRU_CACHE_ENTRY_NIL && !put);
+    }
+
+    // A scan of keys used once only evicts its own keys
+    for (key = 100; key < 120; key++) {
+        lru_cache_lru2_get_or_put(&k, &key, &put);
+        assert(put);
+    }
+
+    for (key = 1; key <= 2; key++) {
+        assert(lru_cache_get_or_put(&c, &key, NULL) != LRU_CACHE_ENTRY_NIL);
+    }
+
+    key = 117;
+    assert(lru_cache_get_or_put(&c, &key, NULL) == LRU_CACHE_ENTRY_NIL);
+
+    // An evicted key found in the history counts as used twice
+    lru_cache_lru2_get_or_put(&k, &key, &put);
+    assert(put && k.history_hits == 1);
+
+    for (key = 200; key < 210; key++) {
+        lru_cache_lru2_get_or_put(&k, &key, &put);
+    }
+
+    key = 117;
+    assert(lru_cache_get_or_put(&c, &key, NULL) != LRU_CACHE_ENTRY_NIL);
+    key = 208;
+    assert(lru_cache_get_or_put(&c, &key, NULL) == LRU_CACHE_ENTRY_NIL);
+    key = 209;
+    assert(lru_cache_get_or_put(&c, &key, NULL) != LRU_CACHE_ENTRY_NIL);
+
+    // A pinned heap top is passed over for the next entry by LRU-2, not by recency
+    lru_cache_lru2_free(&k);
+    lru_cache_flush(&c);
+    assert(lru_cache_lru2_init(&k, &c, 16) == 0);
+
+    // Keys 1 and 2 are used twice, then 3 and 4 once, so 1 is the LRU entry and 3 the heap top
+    for (key = 1; key <= 4; key++) {
+        lru_cache_lru2_get_or_put(&k, &key, &put);
+
+        if (key <= 2) {
+            lru_cache_lru2_get_or_put(&k, &key, &put);
+        }
+    }
+
+    key = 3;
+    assert((i = lru_cache_find(&c, &key)) != LRU_CACHE_ENTRY_NIL && lru_cache_pin(&c, i) == 0);
+
+    key = 5;
+    assert(lru_cache_lru2_get_or_put(&k, &key, &put) != LRU_CACHE_ENTRY_NIL && put);
+
+    key = 4;
+    assert(lru_cache_find(&c, &key) == LRU_CACHE_ENTRY_NIL);
+    key = 1;
+    assert(lru_cache_find(&c, &key) != LRU_CACHE_ENTRY_NIL);
+
+    // Once unpinned, key 3 is the heap top again
+    lru_cache_unpin(&c, i);
+
+    key = 6;
+    assert(lru_cache_lru2_get_or_put(&k, &key, &put) != LRU_CACHE_ENTRY_NIL && put);
+    key = 3;
+    assert(lru_cache_find(&c, &key) == LRU_CACHE_ENTRY_NIL);
+
+    lru_cache_lru2_free(&k);
+    free(hashmap);
+    free(cache);
+}
+
+static void test_cache_key_alignment(void)
+{
+    uint32_t size, i, j;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    unsigned char key[112];
+    bool put;
+
+    assert(lru_cache_align(100, 64, &size) == 0 && size == 112);
+    assert(lru_cache_align(16, 32, &size) == 0 && size == 16);
+    assert(lru_cache_align(100, 48, NULL) == EINVAL);
+    assert(lru_cache_align(100, 2 * LRU_CACHE_ALIGN_MAX, NULL) == EINVAL);
+
+    assert(lru_cache_init(&c, 112, NULL, NULL, NULL) == 0);
+    assert(lru_cache_set_align(&c, 256) == EINVAL);
+    assert(lru_cache_set_align(&c, 64) == 0);
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+    assert(cache_bytes == 48 + 8 * 128);
+    assert(lru_cache_set_align(&c, 32) == EBUSY);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = aligned_alloc(64, (cache_bytes + 63) & ~(size_t)63);
+
+    assert(lru_cache_set_memory(&c, hashmap, (char *)cache + 16) == EINVAL);
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+
+    for (i = 0; i < 8; i++) {
+        assert((uintptr_t)lru_cache_get_entry(&c, i)->key % 64 == 0);
+    }
+
+    // Keys differing in a full 32-byte block or only in the trailing bytes
+    for (i = 0; i < 8; i++) {
+        memset(key, 0, sizeof(key));
+        key[40] = i & 3;
+        key[111] = i >> 2;
+        assert(lru_cache_get_or_put(&c, key, &put) == i && put);
+    }
+
+    for (i = 0; i < 8; i++) {
+        memset(key, 0, sizeof(key));
+        key[40] = i & 3;
+        key[111] = i >> 2;
+        assert((j = lru_cache_get_or_put(&c, key, NULL)) != LRU_CACHE_ENTRY_NIL);
+        assert(memcmp(lru_cache_get_entry(&c, j)->key, key, sizeof(key)) == 0);
+    }
+
+    key[111] = 2;
+    assert(lru_cache_get_or_put(&c, key, NULL) == LRU_CACHE_ENTRY_NIL);
+
+    free(hashmap);
+    free(cache);
+}
+
+static uint64_t written_keys[16];
+static uint32_t written_nmemb;
+static uint32_t write_calls;
+
+static int write_keys(void *arg, struct lru_cache *s, const uint32_t *indices, uint32_t n)
+{
+    uint32_t k;
+
+    if (*(bool *)arg) {
+        return EIO;
+    }
+
+    for (k = 0; k < n; k++) {
+        memcpy(&written_keys[written_nmemb++], lru_cache_get_entry(s, indices[k])->key, sizeof(uint64_t));
+    }
+
+    write_calls++;
+    return 0;
+}
+
+static void test_cache_writeback(void)
+{
+    bool put;
+    bool fail = false;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap, *cache;
+    uint32_t i;
+    uint64_t key;
+    struct lru_cache_writeback w;
+
+    assert(lru_cache_init(&c, sizeof(uint64_t), hash_u32, compare_u64, NULL) == 0);
+    assert(lru_cache_set_nmemb(&c, 8, &hashmap_bytes, &cache_bytes) == 0);
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    assert(lru_cache_set_memory(&c, hashmap, cache) == 0);
+    assert(lru_cache_writeback_init(&w, &c, 0, write_keys, &fail) == EINVAL);
+    assert(lru_cache_writeback_init(&w, &c, 3, write_keys, &fail) == 0);
+
+    for (key = 1; key <= 8; key++) {
+        // Nothing is evicted before the cache is full
+        assert(lru_cache_writeback(&w, 8) == 0 && write_calls == 0);
+
+        i = lru_cache_writeback_get_or_put(&w, &key, &put);
+        assert(i != LRU_CACHE_ENTRY_NIL && put && !lru_cache_writeback_is_dirty(&w, i));
+
+        if (key != 3 && key != 6 && key != 8) {
+            lru_cache_writeback_mark_dirty(&w, i);
+        }
+    }
+
+    // Evicting key 1 writes it with the next dirty entries, in LRU order
+    key = 9;
+    assert(lru_cache_writeback_get_or_put(&w, &key, &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(write_calls == 1 && written_nmemb == 3);
+    assert(written_keys[0] == 1 && written_keys[1] == 2 && written_keys[2] == 4);
+    assert(w.ndirty == 2);
+
+    // Clean victims are evicted without writing
+    key = 10;
+    assert(lru_cache_writeback_get_or_put(&w, &key, &put) != LRU_CACHE_ENTRY_NIL && put);
+    key = 11;
+    assert(lru_cache_writeback_get_or_put(&w, &key, &put) != LRU_CACHE_ENTRY_NIL && put);
+    key = 12;
+    assert(lru_cache_writeback_get_or_put(&w, &key, &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(write_calls == 1);
+
+    // A failed write keeps the dirty victim
+    fail = true;
+    key = 13;
+    assert(lru_cache_writeback_get_or_put(&w, &key, &put) == LRU_CACHE_ENTRY_NIL && !put);
+    assert(w.errors == 1 && w.ndirty == 2);
+
+    key = 5;
+    assert((i = lru_cache_find(&c, &key)) != LRU_CACHE_ENTRY_NIL && lru_cache_writeback_is_dirty(&w, i));
+
+    // Cleaning ahead of eviction
+    fail = false;
+    assert(lru_cache_writeback(&w, 8) == 2);
+    assert(write_calls == 2 && written_keys[3] == 5 && written_keys[4] == 7);
+    assert(w.ndirty == 0);
+
+    key = 13;
+    assert(lru_cache_writeback_get_or_put(&w, &key, &put) != LRU_CACHE_ENTRY_NIL && put);
+    assert(write_calls == 2);
+
+    // Sync writes entries in the recency order, then pinned ones
+    key = 12;
+    i = lru_cache_writeback_get_or_put(&w, &key, NULL);
+    lru_cache_writeback_mark_dirty(&w, i);
+    assert(lru_cache_pin(&c, i) == 0);
+
+    key = 9;
+    lru_cache_writeback_mark_dirty(&w, lru_cache_writeback_get_or_put(&w, &key, NULL));
+
+    fail = true;
+    assert(lru_cache_writeback_sync(&w) == EIO && w.ndirty == 2);
+
+    fail = false;
+    assert(lru_cache_writeback_sync(&w) == 0 && w.ndirty == 0);
+    assert(write_calls == 4 && written_keys[5] == 9 && written_keys[6] == 12);
+
+    lru_cache_unpin(&c, i);
+
+    // Flushing writes dirty entries first, and keeps the cache while they cannot be written
+    key = 12;
+    lru_cache_writeback_mark_dirty(&w, i);
+
+    fail = true;
+    assert(lru_cache_writeback_flush(&w) == EIO && w.ndirty == 1);
+    assert(lru_cache_find(&c, &key) != LRU_CACHE_ENTRY_NIL);
+
+    fail = false;
+    assert(lru_cache_writeback_flush(&w) == 0 && w.ndirty == 0);
+    assert(write_calls == 5 && written_keys[7] == 12);
+    assert(lru_cache_find(&c, &key) == LRU_CACHE_ENTRY_NIL);
+
+    // The cache must not be resized or defer evictions
+    lru_cache_writeback_free(&w);
+    assert(lru_cache_set_nmemb(&c, 16, &hashmap_bytes, &cache_bytes) == 0);
+    assert(lru_cache_writeback_init(&w, &c, 3, write_keys, &fail) == EINVAL);
+
+    lru_cache_writeback_free(&w);
+    free(hashmap);
+    free(cache);
+}
+
+int main()
+{
+    perf_counters_open(&counters);
+
     TEST(test_cache_collision_first_in_local_chain);
     TEST(test_cache_invalid_alignment);
     TEST(test_cache_invalid_size_nmemb);
@@ -547,4 +2290,27 @@ int main()
     TEST(test_cache_set_nmemb_initial_multi);
     TEST(test_cache_set_nmemb_multi);
     TEST(test_cache_insert_order);
+    TEST(test_cache_lazy_flush);
+    TEST(test_cache_lazy_flush_with_collisions);
+    TEST(test_cache_deferred_evictions);
+    TEST(test_cache_get_or_load);
+    TEST(test_cache_trace);
+    TEST(test_cache_mrc);
+    TEST(test_cache_autosize);
+    TEST(test_cache_autosize_aligned);
+    TEST(test_cache_power_of_two_buckets);
+    TEST(test_cache_load_factor);
+    TEST(test_cache_keyed_hash);
+    TEST(test_cache_tier);
+    TEST(test_cache_tier_evict_ahead);
+    TEST(test_cache_seqlock);
+    TEST(test_cache_access_buffer);
+    TEST(test_cache_bulk_load);
+    TEST(test_cache_bucket_tags);
+    TEST(test_cache_pin);
+    TEST(test_cache_lru2);
+    TEST(test_cache_key_alignment);
+    TEST(test_cache_writeback);
+
+    perf_counters_close(&counters);
 }
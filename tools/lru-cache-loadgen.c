@@ -0,0 +1,421 @@
+#include "lru-cache.h"
+#include "lru-cache-server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * Closed-loop load generator for lru-cache-server. Every thread connects to all event loops of the
+ * server, then repeatedly sends `depth` requests for uniformly random keys, each to the loop owning
+ * its key, and waits for all responses before sending the next batch. Requests are gets, deletes and
+ * sets in the given proportions. Reports throughput, the hit ratio of gets and latency percentiles
+ * of single requests, measured from the start of their batch.
+ *
+ * usage: lru-cache-loadgen [-j threads] [-d depth] [-t seconds] [-k keys] [-v value_size] [-g get_percent]
+ *                          [-x delete_percent] path
+ */
+
+#define MAX_LOOPS 1024
+#define OPAQUE_GET (1u << 31)
+
+// Latencies in ns, with 16 buckets per power of two for a resolution of about 6%
+#define HIST_SUB_BITS 4
+#define HIST_NMEMB (64 << HIST_SUB_BITS)
+
+struct shard {
+    int fd;
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    char *in;
+    size_t in_len;
+    size_t in_size;
+    uint32_t expected;
+};
+
+struct worker {
+    pthread_t tid;
+    uint64_t rng;
+    struct shard shards[MAX_LOOPS];
+
+    uint64_t ops;
+    uint64_t gets;
+    uint64_t hits;
+    uint64_t hist[HIST_NMEMB];
+    int error;
+};
+
+// Leaves room for the suffix of the event loop
+static char path[sizeof(((struct sockaddr_un *)0)->sun_path) - sizeof(".4294967295")];
+static uint32_t nloops;
+static uint32_t depth = 16;
+static double seconds = 5;
+static uint32_t nkeys = 100000;
+static uint32_t value_size = 100;
+static uint32_t get_percent = 90;
+static uint32_t delete_percent = 0;
+static char *value;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t next(uint64_t *x)
+{
+    // xorshift64*
+    *x ^= *x >> 12;
+    *x ^= *x << 25;
+    *x ^= *x >> 27;
+    return *x * 0x2545f4914f6cdd1dull;
+}
+
+static uint32_t hist_index(uint64_t v)
+{
+    uint32_t e;
+
+    if (v < (1u << HIST_SUB_BITS)) {
+        return (uint32_t)v;
+    }
+
+    e = 63 - __builtin_clzll(v);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (uint32_t)((v >> (e - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+static uint64_t hist_value(uint32_t k)
+{
+    uint32_t e = (k >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+
+    if (k < (1u << HIST_SUB_BITS)) {
+        return k;
+    }
+
+    return ((uint64_t)(1u << HIST_SUB_BITS) + (k & ((1u << HIST_SUB_BITS) - 1))) << (e - HIST_SUB_BITS);
+}
+
+static double percentile(const uint64_t *hist, uint64_t total, double p)
+{
+    uint64_t rank = (uint64_t)(total * p);
+    uint64_t seen = 0;
+    uint32_t k;
+
+    for (k = 0; k < HIST_NMEMB; k++) {
+        if ((seen += hist[k]) > rank) {
+            return hist_value(k) / 1e3;
+        }
+    }
+
+    return 0;
+}
+
+static int connect_to(uint32_t id, int *fd_)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.%u", path, id);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return errno;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+        close(fd);
+        return errno;
+    }
+
+    *fd_ = fd;
+    return 0;
+}
+
+static void enqueue(struct worker *w, uint32_t opaque)
+{
+    struct lru_cache_server_request rq = { 0 };
+    char key[LRU_CACHE_SERVER_KEY_MAX + 1];
+    uint64_t r = next(&w->rng);
+    uint32_t p = (r >> 32) % 100;
+    struct shard *sh;
+
+    rq.klen = (uint8_t)snprintf(key, sizeof(key), "key:%u", (uint32_t)(r % nkeys));
+    rq.op = (p < get_percent) ? LRU_CACHE_SERVER_GET :
+        (p < get_percent + delete_percent) ? LRU_CACHE_SERVER_DELETE : LRU_CACHE_SERVER_SET;
+    rq.vlen = (rq.op == LRU_CACHE_SERVER_SET) ? value_size : 0;
+    rq.opaque = opaque | ((rq.op == LRU_CACHE_SERVER_GET) ? OPAQUE_GET : 0);
+    w->gets += (rq.op == LRU_CACHE_SERVER_GET);
+
+    sh = &w->shards[lru_cache_server_shard(key, rq.klen, nloops)];
+    memcpy(sh->out + sh->out_len, &rq, sizeof(rq));
+    memcpy(sh->out + sh->out_len + sizeof(rq), key, rq.klen);
+    memcpy(sh->out + sh->out_len + sizeof(rq) + rq.klen, value, rq.vlen);
+    sh->out_len += sizeof(rq) + rq.klen + rq.vlen;
+    sh->expected++;
+}
+
+// Consumes complete responses, counting them in `*n`, and makes room for the next incomplete one
+static int consume(struct worker *w, struct shard *sh, uint64_t start, uint32_t *n)
+{
+    struct lru_cache_server_response rp;
+    uint64_t latency = now_ns() - start;
+    size_t off = 0;
+    size_t need = 0;
+    char *in;
+
+    *n = 0;
+
+    while (sh->in_len - off >= sizeof(rp)) {
+        memcpy(&rp, sh->in + off, sizeof(rp));
+
+        // Values stored by other clients may be larger than ours
+        if (sh->in_len - off < sizeof(rp) + rp.vlen) {
+            need = sizeof(rp) + rp.vlen;
+            break;
+        }
+
+        w->hits += (rp.status == LRU_CACHE_SERVER_OK && (rp.opaque & OPAQUE_GET));
+        w->hist[hist_index(latency)]++;
+        off += sizeof(rp) + rp.vlen;
+        (*n)++;
+    }
+
+    memmove(sh->in, sh->in + off, sh->in_len - off);
+    sh->in_len -= off;
+
+    if (need > sh->in_size) {
+        if ((in = realloc(sh->in, need)) == NULL) {
+            return ENOMEM;
+        }
+
+        sh->in = in;
+        sh->in_size = need;
+    }
+
+    return 0;
+}
+
+static int batch(struct worker *w)
+{
+    struct pollfd pfds[MAX_LOOPS];
+    uint64_t start = now_ns();
+    uint32_t remaining = depth;
+    uint32_t k;
+    uint32_t done;
+    ssize_t n;
+    int rv;
+    struct shard *sh;
+
+    for (k = 0; k < depth; k++) {
+        enqueue(w, k);
+    }
+
+    // Reading while writing, so neither side blocks on a full socket buffer
+    while (remaining > 0) {
+        for (k = 0; k < nloops; k++) {
+            sh = &w->shards[k];
+            pfds[k].fd = sh->fd;
+            pfds[k].events = (sh->out_sent < sh->out_len ? POLLOUT : 0) | (sh->expected ? POLLIN : 0);
+        }
+
+        if (poll(pfds, nloops, -1) < 0) {
+            return errno;
+        }
+
+        for (k = 0; k < nloops; k++) {
+            sh = &w->shards[k];
+
+            if (pfds[k].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                return EPIPE;
+            }
+
+            if ((pfds[k].revents & POLLOUT) && (n = write(sh->fd, sh->out + sh->out_sent, sh->out_len - sh->out_sent)) > 0) {
+                sh->out_sent += n;
+            }
+
+            if ((pfds[k].revents & POLLIN) && (n = read(sh->fd, sh->in + sh->in_len, sh->in_size - sh->in_len)) > 0) {
+                sh->in_len += n;
+
+                if ((rv = consume(w, sh, start, &done)) != 0) {
+                    return rv;
+                }
+
+                sh->expected -= done;
+                remaining -= done;
+            } else if ((pfds[k].revents & POLLIN) && n == 0) {
+                return EPIPE;
+            }
+        }
+    }
+
+    for (k = 0; k < nloops; k++) {
+        w->shards[k].out_len = 0;
+        w->shards[k].out_sent = 0;
+    }
+
+    w->ops += depth;
+    return 0;
+}
+
+static void *run(void *arg)
+{
+    struct worker *w = arg;
+    uint64_t end = now_ns() + (uint64_t)(seconds * 1e9);
+    size_t out_size = depth * (sizeof(struct lru_cache_server_request) + LRU_CACHE_SERVER_KEY_MAX + value_size);
+    size_t in_size = depth * (sizeof(struct lru_cache_server_response) + value_size);
+    uint32_t k;
+
+    for (k = 0; k < nloops; k++) {
+        w->shards[k].fd = -1;
+    }
+
+    for (k = 0; k < nloops && w->error == 0; k++) {
+        w->shards[k].out = malloc(out_size);
+        w->shards[k].in = malloc(in_size);
+        w->shards[k].in_size = in_size;
+
+        if (w->shards[k].out == NULL || w->shards[k].in == NULL) {
+            w->error = ENOMEM;
+        } else {
+            w->error = connect_to(k, &w->shards[k].fd);
+        }
+    }
+
+    while (w->error == 0 && now_ns() < end) {
+        w->error = batch(w);
+    }
+
+    for (k = 0; k < nloops; k++) {
+        if (w->shards[k].fd >= 0) {
+            close(w->shards[k].fd);
+        }
+
+        free(w->shards[k].out);
+        free(w->shards[k].in);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int rv = 0;
+    int opt;
+    int fd;
+    long threads = 1;
+    long k;
+    uint64_t ops = 0, gets = 0, hits = 0;
+    uint64_t start;
+    static uint64_t hist[HIST_NMEMB];
+    struct worker *workers;
+
+    while ((opt = getopt(argc, argv, "j:d:t:k:v:g:x:")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = strtol(optarg, NULL, 10);
+            break;
+        case 'd':
+            depth = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            seconds = strtod(optarg, NULL);
+            break;
+        case 'k':
+            nkeys = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            value_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            get_percent = strtoul(optarg, NULL, 10);
+            break;
+        case 'x':
+            delete_percent = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if (optind != argc - 1 || threads < 1 || depth < 1 || depth > UINT16_MAX || nkeys < 1 || get_percent > 100 ||
+        delete_percent > 100 - get_percent || value_size > (1u << 24) || strlen(argv[optind]) >= sizeof(path)) {
+        fprintf(stderr, "usage: %s [-j threads] [-d depth] [-t seconds] [-k keys] [-v value_size] [-g get_percent] "
+            "[-x delete_percent] path\n", argv[0]);
+        return 2;
+    }
+
+    strcpy(path, argv[optind]);
+
+    // The server listens on one socket per event loop
+    for (nloops = 0; nloops < MAX_LOOPS && connect_to(nloops, &fd) == 0; nloops++) {
+        close(fd);
+    }
+
+    if (nloops == 0) {
+        fprintf(stderr, "%s.0: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    workers = calloc(threads, sizeof(*workers));
+    value = calloc(1, value_size + 1);
+
+    if (workers == NULL || value == NULL) {
+        fprintf(stderr, "%s\n", strerror(ENOMEM));
+        return 1;
+    }
+
+    memset(value, 'v', value_size);
+    start = now_ns();
+
+    for (k = 0; k < threads; k++) {
+        workers[k].rng = 0x9e3779b97f4a7c15ull * (k + 1);
+
+        if ((rv = pthread_create(&workers[k].tid, NULL, run, &workers[k])) != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rv));
+            return 1;
+        }
+    }
+
+    for (k = 0; k < threads; k++) {
+        pthread_join(workers[k].tid, NULL);
+
+        if (workers[k].error != 0) {
+            fprintf(stderr, "thread %ld: %s\n", k, strerror(workers[k].error));
+            rv = 1;
+        }
+
+        ops += workers[k].ops;
+        gets += workers[k].gets;
+        hits += workers[k].hits;
+
+        for (opt = 0; opt < HIST_NMEMB; opt++) {
+            hist[opt] += workers[k].hist[opt];
+        }
+    }
+
+    seconds = (now_ns() - start) / 1e9;
+
+    printf("%-8s %-12s %-10s %-10s %-10s %-10s %s\n", "loops", "ops", "mops", "hit_ratio", "p50_us", "p99_us", "p999_us");
+    printf("%-8u %-12llu %-10.3f %-10.6f %-10.1f %-10.1f %.1f\n",
+        nloops,
+        (unsigned long long)ops,
+        ops / seconds / 1e6,
+        gets ? (double)hits / gets : 0.0,
+        percentile(hist, ops, 0.5),
+        percentile(hist, ops, 0.99),
+        percentile(hist, ops, 0.999));
+
+    free(workers);
+    free(value);
+    return rv;
+}
@@ -0,0 +1,222 @@
+#include "lru-cache.h"
+#include "lru-cache-trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * Replays a trace written by lru_cache_trace_record through caches of several capacities and
+ * reports the hit ratio and throughput of each. Capacity points are distributed over threads. The
+ * recorded hashes stand in for the keys, so keys whose hashes collided in the traced cache count as
+ * one key.
+ *
+ * usage: lru-cache-replay [-j threads] trace capacity...
+ */
+
+struct point {
+    uint32_t nmemb;
+    uint64_t hits;
+    double seconds;
+    int error;
+};
+
+static struct lru_cache_trace_record *records;
+static size_t records_nmemb;
+
+static struct point *points;
+static size_t points_nmemb;
+static atomic_size_t points_next;
+
+static uint32_t hash_u64(const void *a)
+{
+    uint64_t h;
+    memcpy(&h, a, sizeof(h));
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(uint64_t));
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int replay(struct point *p)
+{
+    int rv;
+    bool put;
+    size_t i;
+    double start;
+    size_t hashmap_bytes, cache_bytes;
+    void *hashmap = NULL, *cache = NULL;
+    struct lru_cache c;
+
+    rv = lru_cache_init(&c, sizeof(uint64_t), hash_u64, compare_u64, NULL);
+    if (rv != 0) {
+        return rv;
+    }
+
+    rv = lru_cache_set_nmemb(&c, p->nmemb, &hashmap_bytes, &cache_bytes);
+    if (rv != 0) {
+        return rv;
+    }
+
+    hashmap = malloc(hashmap_bytes);
+    cache = malloc(cache_bytes);
+
+    if (hashmap == NULL || cache == NULL) {
+        rv = ENOMEM;
+        goto out;
+    }
+
+    rv = lru_cache_set_memory(&c, hashmap, cache);
+    if (rv != 0) {
+        goto out;
+    }
+
+    start = now();
+
+    for (i = 0; i < records_nmemb; i++) {
+        lru_cache_get_or_put(&c, &records[i].hash, &put);
+        p->hits += !put;
+    }
+
+    p->seconds = now() - start;
+
+out:
+    free(hashmap);
+    free(cache);
+    return rv;
+}
+
+static void *worker(void *arg)
+{
+    size_t i;
+
+    (void)arg;
+
+    while ((i = atomic_fetch_add(&points_next, 1)) < points_nmemb) {
+        points[i].error = replay(&points[i]);
+    }
+
+    return NULL;
+}
+
+static int load(const char *path)
+{
+    FILE *f;
+    long size;
+    char magic[sizeof(LRU_CACHE_TRACE_MAGIC) - 1];
+    int rv = 0;
+
+    if ((f = fopen(path, "rb")) == NULL) {
+        return errno;
+    }
+
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, LRU_CACHE_TRACE_MAGIC, sizeof(magic)) != 0) {
+        rv = EINVAL;
+        goto out;
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, sizeof(magic), SEEK_SET) != 0) {
+        rv = errno;
+        goto out;
+    }
+
+    records_nmemb = (size - sizeof(magic)) / sizeof(*records);
+    records = malloc(records_nmemb * sizeof(*records));
+
+    if (records == NULL) {
+        rv = ENOMEM;
+        goto out;
+    }
+
+    if (fread(records, sizeof(*records), records_nmemb, f) != records_nmemb) {
+        rv = EIO;
+    }
+
+out:
+    fclose(f);
+    return rv;
+}
+
+int main(int argc, char **argv)
+{
+    int rv;
+    int arg = 1;
+    size_t i;
+    long threads = 1;
+    pthread_t *tids;
+
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+        threads = strtol(argv[2], NULL, 10);
+        arg = 3;
+    }
+
+    if (argc - arg < 2 || threads < 1) {
+        fprintf(stderr, "usage: %s [-j threads] trace capacity...\n", argv[0]);
+        return 2;
+    }
+
+    rv = load(argv[arg]);
+    if (rv != 0) {
+        fprintf(stderr, "%s: %s\n", argv[arg], strerror(rv));
+        return 1;
+    }
+
+    points_nmemb = argc - arg - 1;
+    points = calloc(points_nmemb, sizeof(*points));
+    tids = calloc(threads, sizeof(*tids));
+
+    if (points == NULL || tids == NULL) {
+        fprintf(stderr, "%s\n", strerror(ENOMEM));
+        return 1;
+    }
+
+    for (i = 0; i < points_nmemb; i++) {
+        points[i].nmemb = strtoul(argv[arg + 1 + i], NULL, 10);
+    }
+
+    for (i = 0; i < (size_t)threads; i++) {
+        if ((rv = pthread_create(&tids[i], NULL, worker, NULL)) != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rv));
+            return 1;
+        }
+    }
+
+    for (i = 0; i < (size_t)threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    printf("%-12s %-12s %-10s %s\n", "capacity", "hits", "hit_ratio", "mops");
+
+    for (i = 0; i < points_nmemb; i++) {
+        if (points[i].error != 0) {
+            fprintf(stderr, "capacity %u: %s\n", points[i].nmemb, strerror(points[i].error));
+            rv = 1;
+            continue;
+        }
+
+        printf("%-12u %-12llu %-10.6f %.2f\n",
+            points[i].nmemb,
+            (unsigned long long)points[i].hits,
+            records_nmemb ? (double)points[i].hits / records_nmemb : 0.0,
+            points[i].seconds > 0 ? records_nmemb / points[i].seconds / 1e6 : 0.0);
+    }
+
+    free(tids);
+    free(points);
+    free(records);
+    return rv;
+}
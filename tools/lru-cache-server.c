@@ -0,0 +1,611 @@
+#include "lru-cache.h"
+#include "lru-cache-server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+/*
+ * Serves get, set and delete over Unix domain sockets, see lru-cache-server.h. Each event loop runs
+ * in its own thread with its own cache, so loops share nothing and take no locks.
+ *
+ * Values are stored in a slab indexed by cache entry. A hit is sent straight from the slab: the entry
+ * is pinned until the write of its batch returns, and whatever the socket did not accept is copied
+ * to the connection before the pin is released.
+ *
+ * usage: lru-cache-server [-j loops] [-n entries] [-v value_max] path
+ */
+
+#define CACHE_LINE_SIZE 64
+#define READ_SIZE 65536
+#define PENDING_MAX (4 * READ_SIZE)
+#define MAX_EVENTS 64
+#define MAX_CHUNKS 1024
+#define TOMBSTONE UINT32_MAX
+
+// With its 16-byte header, an entry fills exactly one cache line
+struct key {
+    uint8_t len;
+    char data[LRU_CACHE_SERVER_KEY_MAX];
+};
+
+struct slot {
+    uint32_t vlen; ///< Length of the value, or TOMBSTONE if the key was deleted.
+    uint32_t pins; ///< Number of responses of the current batch referencing the value.
+};
+
+struct buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+// A range of a response batch, in the value slab or, if data is NULL, at offset off of loop->out
+struct chunk {
+    const char *data;
+    size_t off;
+    size_t len;
+};
+
+struct conn {
+    int fd;
+    uint32_t events;
+    struct buffer in; ///< Bytes of requests not yet handled.
+    struct buffer pending; ///< Bytes of responses the socket did not accept yet.
+    struct conn *prev;
+    struct conn *next;
+};
+
+struct loop {
+    pthread_t tid;
+    int epfd;
+    int listen_fd;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+    struct lru_cache c;
+    void *hashmap;
+    void *cache;
+    char *values;
+    struct slot *slots;
+    uint32_t value_max;
+
+    struct buffer out; ///< Response headers, and values that could not be pinned.
+    struct chunk chunks[MAX_CHUNKS];
+    uint32_t nchunks;
+    uint32_t pinned[MAX_CHUNKS];
+    uint32_t npinned;
+
+    struct conn *conns;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static int reserve(struct buffer *b, size_t len)
+{
+    size_t cap = b->cap ? b->cap : 4096;
+    char *data;
+
+    if (b->cap - b->len >= len) {
+        return 0;
+    }
+
+    while (cap - b->len < len) {
+        cap *= 2;
+    }
+
+    if ((data = realloc(b->data, cap)) == NULL) {
+        return ENOMEM;
+    }
+
+    b->data = data;
+    b->cap = cap;
+    return 0;
+}
+
+static int append(struct buffer *b, const void *data, size_t len)
+{
+    int rv = reserve(b, len);
+
+    if (rv == 0 && len > 0) {
+        memcpy(b->data + b->len, data, len);
+        b->len += len;
+    }
+
+    return rv;
+}
+
+static int set_events(struct loop *l, struct conn *cn)
+{
+    struct epoll_event ev = { .data.ptr = cn };
+
+    // A client that does not read its responses is not read from either
+    ev.events = (cn->pending.len > PENDING_MAX) ? EPOLLOUT : (cn->pending.len ? EPOLLIN | EPOLLOUT : EPOLLIN);
+
+    if (ev.events == cn->events) {
+        return 0;
+    }
+
+    cn->events = ev.events;
+    return (epoll_ctl(l->epfd, EPOLL_CTL_MOD, cn->fd, &ev) == 0) ? 0 : errno;
+}
+
+static void release(struct loop *l)
+{
+    uint32_t k;
+
+    for (k = 0; k < l->npinned; k++) {
+        l->slots[l->pinned[k]].pins--;
+        lru_cache_unpin(&l->c, l->pinned[k]);
+    }
+
+    l->npinned = 0;
+    l->nchunks = 0;
+    l->out.len = 0;
+}
+
+static int queue(struct loop *l, const void *data, size_t len)
+{
+    struct chunk *last = l->nchunks ? &l->chunks[l->nchunks - 1] : NULL;
+    int rv = append(&l->out, data, len);
+
+    if (rv != 0) {
+        return rv;
+    }
+
+    if (last && last->data == NULL && last->off + last->len == l->out.len - len) {
+        last->len += len;
+    } else {
+        l->chunks[l->nchunks++] = (struct chunk){ NULL, l->out.len - len, len };
+    }
+
+    return 0;
+}
+
+static int send_pending(struct conn *cn)
+{
+    ssize_t n = write(cn->fd, cn->pending.data, cn->pending.len);
+
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : errno;
+    }
+
+    memmove(cn->pending.data, cn->pending.data + n, cn->pending.len - n);
+    cn->pending.len -= n;
+    return 0;
+}
+
+static int flush(struct loop *l, struct conn *cn)
+{
+    struct iovec iov[MAX_CHUNKS];
+    ssize_t n = 0;
+    size_t skip;
+    uint32_t k;
+    int rv = 0;
+
+    for (k = 0; k < l->nchunks; k++) {
+        iov[k].iov_base = (void *)(l->chunks[k].data ? l->chunks[k].data : l->out.data + l->chunks[k].off);
+        iov[k].iov_len = l->chunks[k].len;
+    }
+
+    // Responses must not overtake those still pending
+    if (cn->pending.len == 0 && l->nchunks > 0 && (n = writev(cn->fd, iov, l->nchunks)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            rv = errno;
+        }
+
+        n = 0;
+    }
+
+    for (k = 0; k < l->nchunks && rv == 0; k++) {
+        skip = ((size_t)n < iov[k].iov_len) ? (size_t)n : iov[k].iov_len;
+        n -= skip;
+        rv = append(&cn->pending, (char *)iov[k].iov_base + skip, iov[k].iov_len - skip);
+    }
+
+    release(l);
+
+    if (rv == 0 && cn->pending.len > 0) {
+        rv = send_pending(cn);
+    }
+
+    return rv ? rv : set_events(l, cn);
+}
+
+static int respond(struct loop *l, uint8_t status, uint32_t opaque, uint32_t i)
+{
+    struct lru_cache_server_response rp = { .status = status, .opaque = opaque };
+    const char *value;
+    int rv;
+
+    if (i == LRU_CACHE_ENTRY_NIL) {
+        return queue(l, &rp, sizeof(rp));
+    }
+
+    rp.vlen = l->slots[i].vlen;
+    value = l->values + (size_t)i * l->value_max;
+
+    if ((rv = queue(l, &rp, sizeof(rp))) != 0) {
+        return rv;
+    }
+
+    // Over the pin limit, the value is copied instead
+    if (lru_cache_pin(&l->c, i) != 0) {
+        return queue(l, value, rp.vlen);
+    }
+
+    l->slots[i].pins++;
+    l->pinned[l->npinned++] = i;
+    l->chunks[l->nchunks++] = (struct chunk){ value, 0, rp.vlen };
+    return 0;
+}
+
+static int handle(struct loop *l, struct conn *cn, const struct lru_cache_server_request *rq, const char *data)
+{
+    struct key key = { .len = rq->klen };
+    uint32_t i;
+    bool put;
+    int rv;
+
+    memcpy(key.data, data, rq->klen);
+
+    switch (rq->op) {
+    case LRU_CACHE_SERVER_GET:
+        i = lru_cache_get_or_put(&l->c, &key, NULL);
+
+        if (i == LRU_CACHE_ENTRY_NIL || l->slots[i].vlen == TOMBSTONE) {
+            if (i != LRU_CACHE_ENTRY_NIL) {
+                lru_cache_demote(&l->c, i);
+            }
+
+            return respond(l, LRU_CACHE_SERVER_NOT_FOUND, rq->opaque, LRU_CACHE_ENTRY_NIL);
+        }
+
+        return respond(l, LRU_CACHE_SERVER_OK, rq->opaque, i);
+
+    case LRU_CACHE_SERVER_SET:
+        if ((i = lru_cache_get_or_put(&l->c, &key, &put)) == LRU_CACHE_ENTRY_NIL) {
+            return respond(l, LRU_CACHE_SERVER_ERROR, rq->opaque, LRU_CACHE_ENTRY_NIL);
+        }
+
+        // The old value is still referenced by a response of this batch
+        if (l->slots[i].pins > 0 && (rv = flush(l, cn)) != 0) {
+            return rv;
+        }
+
+        memcpy(l->values + (size_t)i * l->value_max, data + rq->klen, rq->vlen);
+        l->slots[i].vlen = rq->vlen;
+        return respond(l, LRU_CACHE_SERVER_OK, rq->opaque, LRU_CACHE_ENTRY_NIL);
+
+    case LRU_CACHE_SERVER_DELETE:
+        // There is no removal of single entries, so the key is hidden and made the next victim
+        if ((i = lru_cache_find(&l->c, &key)) == LRU_CACHE_ENTRY_NIL || l->slots[i].vlen == TOMBSTONE) {
+            return respond(l, LRU_CACHE_SERVER_NOT_FOUND, rq->opaque, LRU_CACHE_ENTRY_NIL);
+        }
+
+        l->slots[i].vlen = TOMBSTONE;
+        lru_cache_demote(&l->c, i);
+        return respond(l, LRU_CACHE_SERVER_OK, rq->opaque, LRU_CACHE_ENTRY_NIL);
+    }
+
+    return EPROTO;
+}
+
+static int on_readable(struct loop *l, struct conn *cn)
+{
+    struct lru_cache_server_request rq;
+    ssize_t n = read(cn->fd, cn->in.data + cn->in.len, cn->in.cap - cn->in.len);
+    size_t off = 0;
+    size_t size;
+    int rv = 0;
+
+    if (n <= 0) {
+        return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? 0 : (n < 0 ? errno : EPIPE);
+    }
+
+    cn->in.len += n;
+
+    while (cn->in.len - off >= sizeof(rq)) {
+        memcpy(&rq, cn->in.data + off, sizeof(rq));
+
+        if (rq.klen == 0 || rq.klen > LRU_CACHE_SERVER_KEY_MAX || rq.vlen > l->value_max) {
+            return EPROTO;
+        }
+
+        if (rq.reserved != 0 || (rq.op != LRU_CACHE_SERVER_SET && rq.vlen != 0)) {
+            return EPROTO;
+        }
+
+        size = sizeof(rq) + rq.klen + rq.vlen;
+        if (cn->in.len - off < size) {
+            break;
+        }
+
+        // A response takes at most two chunks
+        if (l->nchunks + 2 > MAX_CHUNKS && (rv = flush(l, cn)) != 0) {
+            return rv;
+        }
+
+        if ((rv = handle(l, cn, &rq, cn->in.data + off + sizeof(rq))) != 0) {
+            return rv;
+        }
+
+        off += size;
+    }
+
+    memmove(cn->in.data, cn->in.data + off, cn->in.len - off);
+    cn->in.len -= off;
+    return flush(l, cn);
+}
+
+static void close_conn(struct loop *l, struct conn *cn)
+{
+    release(l);
+    epoll_ctl(l->epfd, EPOLL_CTL_DEL, cn->fd, NULL);
+    close(cn->fd);
+
+    if (cn->prev) {
+        cn->prev->next = cn->next;
+    } else {
+        l->conns = cn->next;
+    }
+
+    if (cn->next) {
+        cn->next->prev = cn->prev;
+    }
+
+    free(cn->in.data);
+    free(cn->pending.data);
+    free(cn);
+}
+
+static void accept_all(struct loop *l)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    struct conn *cn;
+    int fd;
+
+    while ((fd = accept(l->listen_fd, NULL, NULL)) >= 0) {
+        cn = calloc(1, sizeof(*cn));
+
+        // Any complete request fits, so the buffer never needs to grow
+        if (cn == NULL || fcntl(fd, F_SETFL, O_NONBLOCK) != 0 ||
+            reserve(&cn->in, sizeof(struct lru_cache_server_request) + LRU_CACHE_SERVER_KEY_MAX + l->value_max + READ_SIZE) != 0) {
+            if (cn) {
+                free(cn->in.data);
+            }
+
+            free(cn);
+            close(fd);
+            continue;
+        }
+
+        cn->fd = fd;
+        cn->events = EPOLLIN;
+        ev.data.ptr = cn;
+
+        if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            free(cn->in.data);
+            free(cn);
+            close(fd);
+            continue;
+        }
+
+        cn->next = l->conns;
+        if (l->conns) {
+            l->conns->prev = cn;
+        }
+
+        l->conns = cn;
+    }
+}
+
+static void *run(void *arg)
+{
+    struct loop *l = arg;
+    struct epoll_event events[MAX_EVENTS];
+    struct conn *cn;
+    int n, k, rv;
+
+    while (!stop) {
+        if ((n = epoll_wait(l->epfd, events, MAX_EVENTS, 100)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("epoll_wait");
+            break;
+        }
+
+        for (k = 0; k < n; k++) {
+            if ((cn = events[k].data.ptr) == NULL) {
+                accept_all(l);
+                continue;
+            }
+
+            rv = (events[k].events & (EPOLLIN | EPOLLOUT)) ? 0 : EPIPE;
+
+            if (rv == 0 && (events[k].events & EPOLLOUT)) {
+                rv = send_pending(cn);
+                rv = rv ? rv : set_events(l, cn);
+            }
+
+            if (rv == 0 && (events[k].events & EPOLLIN)) {
+                rv = on_readable(l, cn);
+            }
+
+            if (rv != 0) {
+                close_conn(l, cn);
+            }
+        }
+    }
+
+    while (l->conns) {
+        close_conn(l, l->conns);
+    }
+
+    return NULL;
+}
+
+static int listen_on(struct loop *l, const char *path, uint32_t id)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+    if ((size_t)snprintf(l->path, sizeof(l->path), "%s.%u", path, id) >= sizeof(l->path)) {
+        return ENAMETOOLONG;
+    }
+
+    memcpy(addr.sun_path, l->path, sizeof(l->path));
+    unlink(l->path);
+
+    if ((l->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return errno;
+    }
+
+    if (fcntl(l->listen_fd, F_SETFL, O_NONBLOCK) != 0 || bind(l->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        return errno;
+    }
+
+    if (listen(l->listen_fd, SOMAXCONN) != 0 || (l->epfd = epoll_create1(0)) < 0) {
+        return errno;
+    }
+
+    return (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->listen_fd, &ev) == 0) ? 0 : errno;
+}
+
+static int setup(struct loop *l, const char *path, uint32_t id, uint32_t nmemb, uint32_t value_max)
+{
+    size_t hashmap_bytes, cache_bytes;
+    int rv;
+
+    l->value_max = value_max;
+
+    // Keys are zero-padded, so the built-in hash and byte comparison apply
+    rv = lru_cache_init(&l->c, sizeof(struct key), NULL, NULL, NULL);
+    rv = rv ? rv : lru_cache_set_nmemb(&l->c, nmemb, &hashmap_bytes, &cache_bytes);
+    if (rv != 0) {
+        return rv;
+    }
+
+    cache_bytes = (cache_bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+
+    l->hashmap = malloc(hashmap_bytes);
+    l->cache = aligned_alloc(CACHE_LINE_SIZE, cache_bytes);
+    l->values = malloc((size_t)nmemb * value_max);
+    l->slots = calloc(nmemb, sizeof(*l->slots));
+
+    if (l->hashmap == NULL || l->cache == NULL || l->values == NULL || l->slots == NULL) {
+        return ENOMEM;
+    }
+
+    rv = lru_cache_set_memory(&l->c, l->hashmap, l->cache);
+    return rv ? rv : listen_on(l, path, id);
+}
+
+static void teardown(struct loop *l)
+{
+    if (l->listen_fd >= 0) {
+        close(l->listen_fd);
+        unlink(l->path);
+    }
+
+    if (l->epfd >= 0) {
+        close(l->epfd);
+    }
+
+    free(l->hashmap);
+    free(l->cache);
+    free(l->values);
+    free(l->slots);
+    free(l->out.data);
+}
+
+int main(int argc, char **argv)
+{
+    int rv = 0;
+    int opt;
+    long nloops = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long entries = 1 << 20;
+    unsigned long value_max = 1024;
+    long k, started = 0;
+    struct loop *loops;
+    struct sigaction sa = { .sa_handler = on_signal };
+
+    while ((opt = getopt(argc, argv, "j:n:v:")) != -1) {
+        switch (opt) {
+        case 'j':
+            nloops = strtol(optarg, NULL, 10);
+            break;
+        case 'n':
+            entries = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            value_max = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if (optind != argc - 1 || nloops < 1 || entries < (unsigned long)nloops || entries / nloops > UINT32_MAX ||
+        value_max == 0 || value_max > UINT32_MAX - 1) {
+        fprintf(stderr, "usage: %s [-j loops] [-n entries] [-v value_max] path\n", argv[0]);
+        return 2;
+    }
+
+    if ((loops = calloc(nloops, sizeof(*loops))) == NULL) {
+        fprintf(stderr, "%s\n", strerror(ENOMEM));
+        return 1;
+    }
+
+    for (k = 0; k < nloops; k++) {
+        loops[k].listen_fd = -1;
+        loops[k].epfd = -1;
+    }
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    for (k = 0; k < nloops && rv == 0; k++) {
+        if ((rv = setup(&loops[k], argv[optind], k, entries / nloops, value_max)) != 0) {
+            fprintf(stderr, "loop %ld: %s\n", k, strerror(rv));
+        }
+    }
+
+    for (k = 0; k < nloops && rv == 0; k++, started++) {
+        if ((rv = pthread_create(&loops[k].tid, NULL, run, &loops[k])) != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rv));
+            stop = 1;
+        }
+    }
+
+    for (k = 0; k < started; k++) {
+        pthread_join(loops[k].tid, NULL);
+    }
+
+    for (k = 0; k < nloops; k++) {
+        teardown(&loops[k]);
+    }
+
+    free(loops);
+    return rv ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+#ifndef LRU_CACHE_SERVER_H_
+#define LRU_CACHE_SERVER_H_
+
+#include "lru-cache.h"
+
+/*
+ * Protocol of lru-cache-server. Server and clients run on the same host, so all fields are in host
+ * byte order.
+ *
+ * The server runs one event loop per CPU, each owning the keys that lru_cache_server_shard() maps to
+ * it and listening on its own socket, "<path>.<loop>". A request is a header followed by the key and,
+ * for LRU_CACHE_SERVER_SET, the value. Requests may be pipelined: the responses to all requests read
+ * at once are sent back in order with a single write, each a header followed by the value for a
+ * LRU_CACHE_SERVER_GET hit. A malformed request closes the connection.
+ */
+
+#define LRU_CACHE_SERVER_KEY_MAX 47
+
+enum lru_cache_server_op {
+    LRU_CACHE_SERVER_GET = 1,
+    LRU_CACHE_SERVER_SET = 2,
+    LRU_CACHE_SERVER_DELETE = 3,
+};
+
+enum lru_cache_server_status {
+    LRU_CACHE_SERVER_OK = 0,
+    LRU_CACHE_SERVER_NOT_FOUND = 1,
+    LRU_CACHE_SERVER_ERROR = 2,
+};
+
+struct lru_cache_server_request {
+    uint8_t op; ///< One of enum lru_cache_server_op.
+    uint8_t klen; ///< Length of the key, 1 to LRU_CACHE_SERVER_KEY_MAX.
+    uint16_t reserved; ///< Must be 0.
+    uint32_t vlen; ///< Length of the value, 0 unless op is LRU_CACHE_SERVER_SET.
+    uint32_t opaque; ///< Copied to the response.
+};
+
+struct lru_cache_server_response {
+    uint8_t status; ///< One of enum lru_cache_server_status.
+    uint8_t reserved[3];
+    uint32_t vlen; ///< Length of the value following the header.
+    uint32_t opaque; ///< Copied from the request.
+};
+
+/**
+ * @brief Returns the event loop owning a key.
+ *
+ * @param key Pointer to the key.
+ * @param klen Length of the key.
+ * @param nloops Number of event loops of the server.
+ */
+static inline uint32_t lru_cache_server_shard(const void *key, size_t klen, uint32_t nloops)
+{
+    uint64_t h = lru_cache_fnv1a64_step(LRU_CACHE_FNV1A64_IV, key, klen);
+    return (uint32_t)((h ^ (h >> 32)) % nloops);
+}
+
+#endif // LRU_CACHE_SERVER_H_